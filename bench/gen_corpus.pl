@@ -0,0 +1,581 @@
+#!/usr/bin/perl
+
+# Generate a synthetic CVS history for benchmarking cvsps.
+#
+# The history is modelled as a stream of commits over time, so the
+# patchset grouping cvsps has to reconstruct is realistic:  commits touch
+# clusters of files with member timestamps spread over a few seconds,
+# branches are made from trunk (or from other branches) and committed to,
+# releases are tagged, files are removed and re-added, and some files come
+# in through vendor branch imports.
+#
+# Output is either the text of 'cvs log' for the module, suitable for
+# 'cvsps --root /cvsroot --test-log FILE <module>', or a tree of RCS ,v
+# files which can be used as a real repository.  The same seed always
+# produces the same history.
+
+use 5.008;
+use strict;
+use warnings;
+use Getopt::Long;
+use File::Path qw(mkpath);
+use File::Basename qw(dirname);
+use POSIX qw(strftime);
+
+my %opt = (
+    'files'         => 1000,	# files in the module
+    'files-per-dir' => 20,
+    'revs'          => 8,	# average revisions per file, including 1.1
+    'cluster'       => 4,	# average files touched by a commit
+    'spread'        => 3,	# seconds between the members of one commit
+    'gap'           => 7200,	# average seconds between commits
+    'branches'      => 4,
+    'branch-depth'  => 2,	# 1: only branches off trunk
+    'branch-commits'=> 20,	# percent of commits made on branches
+    'tags'          => 10,
+    'dead'          => 3,	# percent of file changes that remove the file
+    'vendor'        => 10,	# percent of files added through a vendor import
+    'vendor-imports'=> 2,	# vendor imports after the initial one
+    'log-repeat'    => 30,	# percent of commits using a stock log message
+    'authors'       => 12,
+    'seed'          => 1,
+    'module'        => 'mod',
+    'cvsroot'       => '/cvsroot',
+    'format'        => 'rlog',
+    'output'        => '-',
+);
+
+sub usage
+{
+    print STDERR <<END;
+Usage: gen_corpus.pl [options]
+  --files N            files in the module ($opt{files})
+  --files-per-dir N    files per directory ($opt{'files-per-dir'})
+  --revs N             average revisions per file ($opt{revs})
+  --cluster N          average files per commit ($opt{cluster})
+  --spread SECS        time spread of the members of one commit ($opt{spread})
+  --gap SECS           average time between commits ($opt{gap})
+  --branches N         number of branches ($opt{branches})
+  --branch-depth N     maximum nesting of branches ($opt{'branch-depth'})
+  --branch-commits PCT percent of commits made on branches ($opt{'branch-commits'})
+  --tags N             number of release tags ($opt{tags})
+  --dead PCT           percent of changes that remove the file ($opt{dead})
+  --vendor PCT         percent of files added by vendor import ($opt{vendor})
+  --vendor-imports N   vendor imports after the first ($opt{'vendor-imports'})
+  --log-repeat PCT     percent of commits with a stock log message ($opt{'log-repeat'})
+  --authors N          number of authors ($opt{authors})
+  --seed N             random seed ($opt{seed})
+  --module NAME        module name ($opt{module})
+  --cvsroot PATH       repository root shown in the log ($opt{cvsroot})
+  --format rlog|rcs    write 'cvs log' text, or RCS files ($opt{format})
+  --output PATH        log file ('-' for stdout) or, for rcs, the cvsroot
+                       directory to create the module in
+END
+    exit 1;
+}
+
+GetOptions(\%opt, 'files=i', 'files-per-dir=i', 'revs=f', 'cluster=f', 'spread=i',
+	   'gap=i', 'branches=i', 'branch-depth=i', 'branch-commits=i', 'tags=i',
+	   'dead=i', 'vendor=i', 'vendor-imports=i', 'log-repeat=i', 'authors=i',
+	   'seed=i', 'module=s', 'cvsroot=s', 'format=s', 'output=s', 'help')
+    or usage();
+usage() if $opt{help} || $opt{format} !~ /^(rlog|rcs)$/;
+
+srand($opt{seed});
+
+my @stock_logs = (
+    "fix typo", "merge from trunk", "update copyright", "fix build",
+    "cleanup", "fix compiler warnings", "add missing include",
+    "revert previous change", "update documentation", "fix memory leak",
+    "bump version", "remove dead code", "fix off by one error",
+    "portability fixes", "regenerate", "fix indentation",
+);
+
+my @words = qw(parser cache buffer socket handler config option table
+	       index lookup stream report thread timer queue client server
+	       module driver format layout widget signal header symbol);
+
+my @authors = map { sprintf("dev%02d", $_) } 1 .. $opt{authors};
+
+#
+# the model.  each file has a hash of revisions, each revision records
+# its date, author, state, log, the next revision in RCS terms (older on
+# trunk, newer on a branch) and the branches that sprout from it.
+# $file->{head}{$branch} is the newest revision on each branch the file
+# is on ('' is trunk).
+#
+my @files;
+my %branch_info = ('' => { depth => 0, files => \@files });
+my @branch_names = ('');
+my $now = 946684800;	# 2000-01-01
+my $num_commits = 0;
+
+sub rand_exp
+{
+    my $mean = shift;
+    return int(-log(1 - rand()) * $mean);
+}
+
+sub cluster_size
+{
+    my $n = 1 + rand_exp($opt{cluster} - 1);
+    return $n;
+}
+
+sub new_log
+{
+    $num_commits++;
+
+    return $stock_logs[int(rand(@stock_logs))] if rand(100) < $opt{'log-repeat'};
+
+    my $n = 2 + int(rand(6));
+    my $msg = "change $num_commits: " . join(' ', map { $words[int(rand(@words))] } 1 .. $n);
+
+    # some messages have a body
+    $msg .= "\n\n" . join(' ', map { $words[int(rand(@words))] } 1 .. 12) if rand() < 0.2;
+
+    return $msg;
+}
+
+sub add_rev
+{
+    my ($f, $rev, $date, $author, $state, $log) = @_;
+
+    $f->{revs}{$rev} = {
+	rev => $rev, date => $date, author => $author, state => $state,
+	log => $log, next => undef, branches => [],
+    };
+
+    return $f->{revs}{$rev};
+}
+
+sub next_rev
+{
+    my $rev = shift;
+    $rev =~ s/(\d+)$/$1 + 1/e;
+    return $rev;
+}
+
+# make a change to $f on $branch at $date
+sub commit_file
+{
+    my ($f, $branch, $date, $author, $log) = @_;
+    my $head = $f->{head}{$branch};
+    my $prev = $f->{revs}{$head};
+    my $rev = next_rev($head);
+    my $state = 'Exp';
+
+    # a removed file is brought back, a live one is sometimes removed
+    $state = 'dead' if $prev->{state} eq 'Exp' && rand(100) < $opt{dead};
+
+    my $r = add_rev($f, $rev, $date, $author, $state, $log);
+
+    if ($branch eq '')
+    {
+	$r->{next} = $head;
+	$f->{default_branch} = undef;
+    }
+    else
+    {
+	$prev->{next} = $rev;
+    }
+
+    $f->{head}{$branch} = $rev;
+}
+
+sub create_file
+{
+    my ($f, $date, $author, $log) = @_;
+
+    push @files, $f;
+    $f->{head}{''} = '1.1';
+    $f->{branch_count} = {};
+
+    if (rand(100) < $opt{vendor})
+    {
+	my $r = add_rev($f, '1.1', $date, $author, 'Exp', "Initial revision");
+	add_rev($f, '1.1.1.1', $date, $author, 'Exp', "import");
+	push @{$r->{branches}}, '1.1.1.1';
+	$f->{vendor} = 1;
+	$f->{default_branch} = '1.1.1';
+	$f->{head}{VENDOR} = '1.1.1.1';
+	$f->{symbols}{VENDOR} = '1.1.1';
+	$f->{symbols}{IMPORT_0} = '1.1.1.1';
+    }
+    else
+    {
+	add_rev($f, '1.1', $date, $author, 'Exp', $log);
+    }
+}
+
+sub make_branch
+{
+    my ($name, $parent) = @_;
+
+    $branch_info{$name} = { depth => $branch_info{$parent}{depth} + 1, files => [] };
+    push @branch_names, $name;
+
+    for my $f (@files)
+    {
+	my $bp = $f->{head}{$parent};
+	next unless defined $bp && $f->{revs}{$bp}{state} eq 'Exp';
+
+	my $num = ($f->{branch_count}{$bp} || 0) + 2;
+	$f->{branch_count}{$bp} = $num;
+	$f->{symbols}{$name} = "$bp.0.$num";
+	$f->{head}{$name} = $bp;
+	$f->{branch_base}{$name} = "$bp.$num";
+	push @{$branch_info{$name}{files}}, $f;
+    }
+}
+
+sub make_tag
+{
+    my ($name, $branch) = @_;
+
+    for my $f (@files)
+    {
+	my $rev = $f->{head}{$branch};
+	next unless defined $rev && $f->{revs}{$rev}{state} eq 'Exp';
+	$f->{symbols}{$name} = $rev;
+    }
+}
+
+# the first commit on a branch creates the branch revision
+sub commit_branch_file
+{
+    my ($f, $branch, $date, $author, $log) = @_;
+
+    if (!$f->{branch_started}{$branch})
+    {
+	my $bp = $f->{revs}{$f->{head}{$branch}};
+	my $rev = "$f->{branch_base}{$branch}.1";
+
+	add_rev($f, $rev, $date, $author, 'Exp', $log);
+	push @{$bp->{branches}}, $rev;
+	$f->{head}{$branch} = $rev;
+	$f->{branch_started}{$branch} = 1;
+	return;
+    }
+
+    commit_file($f, $branch, $date, $author, $log);
+}
+
+sub vendor_import
+{
+    my ($n, $date) = @_;
+
+    for my $f (grep { $_->{vendor} } @files)
+    {
+	commit_file($f, 'VENDOR', $date, $authors[0], "import $n");
+
+	# imports never remove files
+	$f->{revs}{$f->{head}{VENDOR}}{state} = 'Exp';
+	$f->{symbols}{"IMPORT_$n"} = $f->{head}{VENDOR};
+    }
+}
+
+#
+# build the history.  files are added throughout the first half of it,
+# and events (branches, tags, vendor imports) are spread over the whole
+#
+my $total_revs = int($opt{files} * $opt{revs});
+my $num_dirs = int(($opt{files} + $opt{'files-per-dir'} - 1) / $opt{'files-per-dir'});
+my $est_commits = int($total_revs / $opt{cluster}) + 1;
+my @events;
+
+push @events, [int(rand($est_commits)), 'branch', $_] for 1 .. $opt{branches};
+push @events, [int(rand($est_commits)), 'tag', $_] for 1 .. $opt{tags};
+push @events, [int(rand($est_commits)), 'vendor', $_] for 1 .. $opt{'vendor-imports'};
+@events = sort { $a->[0] <=> $b->[0] || $a->[1] cmp $b->[1] || $a->[2] <=> $b->[2] } @events;
+
+my $revs_made = 0;
+my $files_made = 0;
+
+for (my $c = 0; $revs_made < $total_revs; $c++)
+{
+    while (@events && $events[0][0] <= $c)
+    {
+	my (undef, $type, $n) = @{shift @events};
+
+	$now += 60;
+
+	if ($type eq 'branch')
+	{
+	    my @parents = grep { $branch_info{$_}{depth} < $opt{'branch-depth'} } @branch_names;
+	    make_branch("BRANCH_$n", $parents[int(rand(@parents))]);
+	}
+	elsif ($type eq 'tag')
+	{
+	    my @tagged = grep { $_ ne '' } @branch_names;
+	    my $branch = (@tagged && rand() < 0.3) ? $tagged[int(rand(@tagged))] : '';
+	    make_tag("RELEASE_$n", $branch);
+	}
+	else
+	{
+	    vendor_import($n, $now);
+	}
+    }
+
+    $now += 1 + rand_exp($opt{gap});
+
+    my $author = $authors[int(rand(@authors))];
+    my $log = new_log();
+    my $size = cluster_size();
+    my $date = $now;
+    my @members;
+
+    # add new files while there are files left to add, more so early on
+    if ($files_made < $opt{files} && (!@files || rand() < 0.5 || $revs_made >= $total_revs / 2))
+    {
+	my $dir = int(rand($num_dirs));
+
+	for (1 .. $size)
+	{
+	    last if $files_made >= $opt{files};
+
+	    my $f = { path => sprintf("dir%03d/file%05d.c", $dir, $files_made), symbols => {} };
+	    $files_made++;
+	    create_file($f, $date, $author, $log);
+	    $date += int(rand($opt{spread} + 1));
+	    $revs_made++;
+	}
+	next;
+    }
+
+    my @branches = grep { $_ ne '' } @branch_names;
+    my $branch = (@branches && rand(100) < $opt{'branch-commits'}) ? $branches[int(rand(@branches))] : '';
+    my $candidates = $branch_info{$branch}{files};
+    next unless @$candidates;
+
+    # a commit touches files close to each other in the tree
+    my $start = int(rand(@$candidates));
+    for my $i (0 .. $size - 1)
+    {
+	my $f = $candidates->[($start + $i) % @$candidates];
+	last if $i && $f == $candidates->[$start];
+
+	if ($branch eq '')
+	{
+	    commit_file($f, '', $date, $author, $log);
+	}
+	else
+	{
+	    commit_branch_file($f, $branch, $date, $author, $log);
+	}
+
+	$date += int(rand($opt{spread} + 1));
+	$revs_made++;
+    }
+}
+
+#
+# output
+#
+sub rcs_date
+{
+    return strftime("%Y.%m.%d.%H.%M.%S", gmtime(shift));
+}
+
+sub log_date
+{
+    return strftime("%Y/%m/%d %H:%M:%S", gmtime(shift));
+}
+
+sub trunk_revs
+{
+    my $f = shift;
+    my @revs;
+
+    for (my $r = $f->{head}{''}; defined $r; $r = $f->{revs}{$r}{next})
+    {
+	push @revs, $r;
+    }
+
+    return @revs;
+}
+
+sub branch_revs
+{
+    my ($f, $first) = @_;
+    my @revs;
+
+    for (my $r = $first; defined $r; $r = $f->{revs}{$r}{next})
+    {
+	push @revs, $r;
+    }
+
+    return @revs;
+}
+
+sub rcs_path
+{
+    my $f = shift;
+    my $path = $f->{path};
+
+    # removed files live in the Attic
+    $path =~ s|([^/]+)$|Attic/$1| if $f->{revs}{$f->{head}{''}}{state} eq 'dead' && !$f->{default_branch};
+    return "$path,v";
+}
+
+sub sorted_symbols
+{
+    my $f = shift;
+    return sort { $a cmp $b } keys %{$f->{symbols}};
+}
+
+sub put_delta
+{
+    my ($out, $f, $r) = @_;
+    my $rev = $f->{revs}{$r};
+    my $date = log_date($rev->{date});
+
+    print $out "----------------------------\n";
+    print $out "revision $r\n";
+    print $out "date: $date;  author: $rev->{author};  state: $rev->{state};";
+    print $out "  lines: +1 -1" unless $r eq '1.1';
+    print $out "\n";
+    print $out "branches:", (map { my $b = $_; $b =~ s/\.\d+$//; "  $b;" } @{$rev->{branches}}), "\n"
+	if @{$rev->{branches}};
+    print $out "$rev->{log}\n";
+}
+
+# the revision order of rlog: trunk from the head down, then the
+# branches, oldest branch point first, newest branch first
+sub put_tree
+{
+    my ($out, $f, $r) = @_;
+    return unless defined $r;
+
+    put_tree($out, $f, $f->{revs}{$r}{next});
+
+    for my $b (reverse @{$f->{revs}{$r}{branches}})
+    {
+	my @revs = branch_revs($f, $b);
+	put_delta($out, $f, $_) for reverse @revs;
+	put_tree($out, $f, $b);
+    }
+}
+
+sub write_rlog
+{
+    my $out = shift;
+
+    for my $f (sort { $a->{path} cmp $b->{path} } @files)
+    {
+	my @trunk = trunk_revs($f);
+	my $nrevs = scalar keys %{$f->{revs}};
+
+	print $out "\n";
+	print $out "RCS file: $opt{cvsroot}/$opt{module}/", rcs_path($f), "\n";
+	print $out "Working file: $f->{path}\n";
+	print $out "head: $f->{head}{''}\n";
+	print $out "branch:", ($f->{default_branch} ? " $f->{default_branch}" : ""), "\n";
+	print $out "locks: strict\n";
+	print $out "access list:\n";
+	print $out "symbolic names:\n";
+	print $out "\t$_: $f->{symbols}{$_}\n" for sorted_symbols($f);
+	print $out "keyword substitution: kv\n";
+	print $out "total revisions: $nrevs;\tselected revisions: $nrevs\n";
+	print $out "description:\n";
+	put_delta($out, $f, $_) for @trunk;
+	put_tree($out, $f, $f->{head}{''});
+	print $out "=" x 77, "\n";
+    }
+}
+
+sub rcs_string
+{
+    my $s = shift;
+    $s =~ s/@/@@/g;
+    return "\@$s\@";
+}
+
+sub rcs_text
+{
+    my ($f, $r) = @_;
+    return "/* $f->{path} */\nrevision $r\n";
+}
+
+sub write_rcs_file
+{
+    my ($path, $f) = @_;
+    my @trunk = trunk_revs($f);
+    my @all = @trunk;
+    my @queue = @trunk;
+
+    while (@queue)
+    {
+	my $r = shift @queue;
+	for my $b (@{$f->{revs}{$r}{branches}})
+	{
+	    my @revs = branch_revs($f, $b);
+	    push @all, @revs;
+	    push @queue, @revs;
+	}
+    }
+
+    open(my $out, '>', $path) or die "can't create $path: $!";
+
+    print $out "head\t$f->{head}{''};\n";
+    print $out "branch\t$f->{default_branch};\n" if $f->{default_branch};
+    print $out "access;\nsymbols";
+    print $out "\n\t$_:$f->{symbols}{$_}" for sorted_symbols($f);
+    print $out ";\nlocks; strict;\ncomment\t\@ * \@;\n\n";
+
+    for my $r (@all)
+    {
+	my $rev = $f->{revs}{$r};
+	print $out "\n$r\n";
+	print $out "date\t", rcs_date($rev->{date}), ";\tauthor $rev->{author};\tstate $rev->{state};\n";
+	print $out "branches";
+	print $out "\n\t$_" for @{$rev->{branches}};
+	print $out ";\nnext\t", (defined $rev->{next} ? $rev->{next} : ""), ";\n";
+    }
+
+    print $out "\n\ndesc\n\@\@\n";
+
+    # every delta replaces the whole (two line) text of the revision
+    for my $r (@all)
+    {
+	my $rev = $f->{revs}{$r};
+	my $text = ($r eq $f->{head}{''}) ? rcs_text($f, $r) : "d1 2\na2 2\n" . rcs_text($f, $r);
+	print $out "\n\n$r\nlog\n", rcs_string("$rev->{log}\n"), "\ntext\n", rcs_string($text), "\n";
+    }
+
+    close($out) or die "can't write $path: $!";
+}
+
+if ($opt{format} eq 'rlog')
+{
+    my $out;
+
+    if ($opt{output} eq '-')
+    {
+	$out = \*STDOUT;
+    }
+    else
+    {
+	open($out, '>', $opt{output}) or die "can't create $opt{output}: $!";
+    }
+
+    write_rlog($out);
+    close($out) or die "can't write $opt{output}: $!";
+}
+else
+{
+    die "--output must name the cvsroot directory for --format rcs\n" if $opt{output} eq '-';
+
+    mkpath("$opt{output}/CVSROOT");
+    for my $f (@files)
+    {
+	my $path = "$opt{output}/$opt{module}/" . rcs_path($f);
+	mkpath(dirname($path));
+	write_rcs_file($path, $f);
+    }
+}
+
+my $nrevs = 0;
+$nrevs += scalar keys %{$_->{revs}} for @files;
+printf STDERR "generated %d files, %d revisions, %d commits, %d branches, %d tags\n",
+    scalar @files, $nrevs, $num_commits, $opt{branches}, $opt{tags};
@@ -0,0 +1,18 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * Access to the internals of cache.c for the microbenchmarks, see
+ * mb_cvsps.c.
+ */
+
+#include "../cache.c"
+
+#include "microbench.h"
+
+void mb_parse_cache_revision(PatchSetMember * psm, const char * buff)
+{
+    parse_cache_revision(psm, buff);
+}
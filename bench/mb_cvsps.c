@@ -0,0 +1,64 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * Access to the internals of cvsps.c for the microbenchmarks.  The
+ * functions measured are static, so the whole file is compiled here
+ * (with its main() renamed) and thin wrappers are exported.
+ */
+
+#define main cvsps_main
+#include "../cvsps.c"
+#undef main
+
+#include "microbench.h"
+
+/*
+ * Load a log as 'cvsps --root /cvsroot -x --test-log <log> mod' would,
+ * sorted and numbered, but without resolving symbols or printing.
+ */
+void mb_load_corpus(const char * log)
+{
+    debuglvl = DEBUG_APPERROR|DEBUG_SYSERROR;
+
+    file_hash = create_hash_table(1023);
+    global_symbols = create_hash_table(111);
+    branch_heads = create_hash_table(1023);
+
+    strcpy(root_path, "/cvsroot");
+    strcpy(repository_path, "mod");
+    test_log_file = log;
+
+    init_paths();
+    load_from_cvs();
+
+    list_sort(&all_patch_sets, compare_patch_sets_bytime_list);
+    ps_counter = 0;
+    walk_all_patch_sets(assign_patchset_id);
+}
+
+int mb_compare_rev_strings(const char * cr1, const char * cr2)
+{
+    return compare_rev_strings(cr1, cr2);
+}
+
+int mb_compare_patch_sets_bytime_list(struct list_link * l1, struct list_link * l2)
+{
+    return compare_patch_sets_bytime_list(l1, l2);
+}
+
+list_head * mb_all_patch_sets()
+{
+    return &all_patch_sets;
+}
+
+/*
+ * Forget the patch set tree so get_patch_set() starts coalescing afresh.
+ * The old patch sets stay on all_patch_sets.
+ */
+void mb_reset_ps_tree()
+{
+    ps_tree = NULL;
+}
@@ -0,0 +1,441 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * Microbenchmarks of the core data structures.  A log (usually a
+ * synthetic corpus from gen_corpus.pl) is loaded into the model first,
+ * and the keys each benchmark uses are taken from it in patch set order,
+ * so that the key distributions are those cvsps itself sees.  Every
+ * benchmark repeats passes over its keys until the minimum time has been
+ * spent, and reports the time and the number of allocations per
+ * operation.
+ *
+ * usage: microbench [-t <seconds>] [<benchmark>...] <log>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cbtcommon/hash.h>
+#include <cbtcommon/list.h>
+#include <cbtcommon/debug.h>
+
+#include "cvsps_types.h"
+#include "cvsps.h"
+#include "util.h"
+#include "list_sort.h"
+#include "microbench.h"
+
+/*
+ * Allocation counting.  glibc calls malloc through the PLT even from
+ * within itself, so defining these here catches every allocation.
+ */
+extern void * __libc_malloc(size_t);
+extern void * __libc_calloc(size_t, size_t);
+extern void * __libc_realloc(void *, size_t);
+
+static long num_allocs;
+
+void * malloc(size_t size)
+{
+    num_allocs++;
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t nmemb, size_t size)
+{
+    num_allocs++;
+    return __libc_calloc(nmemb, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+    num_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+/* the keys, one entry per patch set member */
+static int num_members;
+static const char ** filenames;
+static const char ** pre_revs;
+static const char ** post_revs;
+static const char ** authors;
+static const char ** logs;
+static const Tag ** branches;
+static char (*dates)[DATE_STR_MAX];
+static char ** cache_lines;
+
+/* the distinct files, in hash order */
+static int num_files;
+static const char ** file_keys;
+
+static int num_patch_sets;
+static PatchSet ** patch_sets;
+
+static double min_time = 0.5;
+
+static struct hash_table * scratch_hash;
+static PatchSetMember scratch_psm;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void * xmalloc(size_t size)
+{
+    void * p = malloc(size);
+
+    if (!p)
+    {
+	debug(DEBUG_SYSERROR, "malloc failed for benchmark keys");
+	exit(1);
+    }
+
+    return p;
+}
+
+static void collect_keys()
+{
+    struct list_link * next;
+    struct hash_entry * he;
+    int i = 0;
+
+    for (next = mb_all_patch_sets()->next; next != mb_all_patch_sets(); next = next->next)
+    {
+	PatchSet * ps = list_entry(next, PatchSet, all_link);
+	struct list_link * m;
+
+	num_patch_sets++;
+	for (m = ps->members.next; m != &ps->members; m = m->next)
+	    num_members++;
+    }
+
+    filenames = xmalloc(num_members * sizeof(*filenames));
+    pre_revs = xmalloc(num_members * sizeof(*pre_revs));
+    post_revs = xmalloc(num_members * sizeof(*post_revs));
+    authors = xmalloc(num_members * sizeof(*authors));
+    logs = xmalloc(num_members * sizeof(*logs));
+    branches = xmalloc(num_members * sizeof(*branches));
+    dates = xmalloc(num_members * sizeof(*dates));
+    cache_lines = xmalloc(num_members * sizeof(*cache_lines));
+    patch_sets = xmalloc(num_patch_sets * sizeof(*patch_sets));
+
+    num_patch_sets = 0;
+    for (next = mb_all_patch_sets()->next; next != mb_all_patch_sets(); next = next->next)
+    {
+	PatchSet * ps = list_entry(next, PatchSet, all_link);
+	struct list_link * m;
+
+	patch_sets[num_patch_sets++] = ps;
+
+	for (m = ps->members.next; m != &ps->members; m = m->next, i++)
+	{
+	    PatchSetMember * psm = list_entry(m, PatchSetMember, link);
+	    char buff[PATH_MAX + 3 * REV_STR_MAX];
+
+	    filenames[i] = psm->file->filename;
+	    pre_revs[i] = psm->pre_rev ? psm->pre_rev->rev : "INITIAL";
+	    post_revs[i] = psm->post_rev->rev;
+	    authors[i] = ps->author;
+	    logs[i] = ps->descr;
+	    branches[i] = psm->post_rev->branch;
+	    strftime(dates[i], DATE_STR_MAX, "%Y/%m/%d %H:%M:%S", gmtime(&ps->date));
+
+	    /*
+	     * branch_point is always 0: a branch point links the revision
+	     * into its parent's branch_children, which can only be done once
+	     */
+	    snprintf(buff, sizeof(buff), "file:%s; pre_rev:%s; post_rev:%s; dead:%d; branch_point:%d\n",
+		     filenames[i], pre_revs[i], post_revs[i], psm->post_rev->dead, 0);
+	    cache_lines[i] = xstrdup(buff);
+	}
+    }
+
+    reset_hash_iterator(file_hash);
+    while ((he = next_hash_entry(file_hash)))
+	num_files++;
+
+    file_keys = xmalloc(num_files * sizeof(*file_keys));
+
+    i = 0;
+    reset_hash_iterator(file_hash);
+    while ((he = next_hash_entry(file_hash)))
+	file_keys[i++] = he->he_key;
+}
+
+/*
+ * Run 'bench' over its 'ops' keys repeatedly until min_time has passed.
+ * 'setup', if given, is run untimed before each pass.
+ */
+static void run(const char * name, long ops, void (*setup)(), void (*bench)())
+{
+    double elapsed = 0.0;
+    long allocs = 0;
+    long passes = 0;
+
+    if (ops == 0)
+	return;
+
+    do
+    {
+	double start;
+	long start_allocs;
+
+	if (setup)
+	    setup();
+
+	start_allocs = num_allocs;
+	start = now();
+	bench();
+	elapsed += now() - start;
+	allocs += num_allocs - start_allocs;
+	passes++;
+    }
+    while (elapsed < min_time);
+
+    printf("%-24s %10ld %12.1f %12.3f\n", name, ops * passes,
+	   elapsed * 1e9 / (ops * passes), (double)allocs / (ops * passes));
+    fflush(stdout);
+}
+
+static void setup_hash_put()
+{
+    if (scratch_hash)
+	destroy_hash_table(scratch_hash, NULL);
+    scratch_hash = create_hash_table(1023);
+}
+
+static void bench_hash_put()
+{
+    int i;
+
+    for (i = 0; i < num_files; i++)
+	put_hash_object(scratch_hash, file_keys[i], (void *)file_keys[i]);
+}
+
+static void bench_hash_get()
+{
+    int i;
+
+    for (i = 0; i < num_members; i++)
+	if (!get_hash_object(file_hash, filenames[i]))
+	    exit(1);
+}
+
+static void bench_hash_iterate()
+{
+    struct hash_entry * he;
+
+    reset_hash_iterator(file_hash);
+    while ((he = next_hash_entry(file_hash)))
+	;
+}
+
+static void bench_get_string()
+{
+    int i;
+
+    for (i = 0; i < num_members; i++)
+    {
+	get_string(authors[i]);
+	get_string(post_revs[i]);
+    }
+}
+
+static void bench_compare_rev_strings()
+{
+    int i;
+
+    for (i = 0; i < num_members; i++)
+	mb_compare_rev_strings(post_revs[i], pre_revs[i]);
+}
+
+static void bench_convert_date()
+{
+    time_t t;
+    int i;
+
+    for (i = 0; i < num_members; i++)
+	convert_date(&t, dates[i]);
+}
+
+/* relink the patch sets in a fixed pseudo random order */
+static void setup_list_sort()
+{
+    list_head * head = mb_all_patch_sets();
+    unsigned int seed = 1;
+    int i;
+
+    for (i = num_patch_sets - 1; i > 0; i--)
+    {
+	int j;
+	PatchSet * tmp;
+
+	seed = seed * 1103515245 + 12345;
+	j = (seed >> 8) % (i + 1);
+	tmp = patch_sets[i];
+	patch_sets[i] = patch_sets[j];
+	patch_sets[j] = tmp;
+    }
+
+    INIT_LIST_HEAD(head);
+    for (i = 0; i < num_patch_sets; i++)
+	list_add(&patch_sets[i]->all_link, head->prev);
+}
+
+static void bench_list_sort()
+{
+    list_sort(mb_all_patch_sets(), mb_compare_patch_sets_bytime_list);
+}
+
+static void bench_parse_cache_revision()
+{
+    int i;
+
+    for (i = 0; i < num_members; i++)
+	mb_parse_cache_revision(&scratch_psm, cache_lines[i]);
+}
+
+static void setup_get_patch_set()
+{
+    mb_reset_ps_tree();
+}
+
+/*
+ * The members are not passed, as when reading the cache, so the
+ * coalescing is decided on author, log, branch and date alone.
+ */
+static void bench_get_patch_set()
+{
+    int i;
+
+    for (i = 0; i < num_members; i++)
+	get_patch_set(dates[i], logs[i], authors[i], branches[i], NULL);
+}
+
+static struct
+{
+    const char * name;
+    void (*setup)();
+    void (*bench)();
+    /* 1 if run per distinct file, 2 per patch set, else per member */
+    int per;
+} benchmarks[] = {
+    { "hash_put", setup_hash_put, bench_hash_put, 1 },
+    { "hash_get", NULL, bench_hash_get, 0 },
+    { "hash_iterate", NULL, bench_hash_iterate, 1 },
+    { "get_string", NULL, bench_get_string, 0 },
+    { "compare_rev_strings", NULL, bench_compare_rev_strings, 0 },
+    { "convert_date", NULL, bench_convert_date, 0 },
+    { "list_sort", setup_list_sort, bench_list_sort, 2 },
+    /* these two change the model, so they come last */
+    { "parse_cache_revision", NULL, bench_parse_cache_revision, 0 },
+    { "get_patch_set", setup_get_patch_set, bench_get_patch_set, 0 },
+    { NULL }
+};
+
+static void usage(const char * str1, const char * str2)
+{
+    int i;
+
+    if (str1)
+	debug(DEBUG_APPERROR, "\nbad usage: %s %s\n", str1, str2);
+
+    debug(DEBUG_APPERROR, "Usage: microbench [-t <seconds>] [<benchmark>...] <log>");
+    debug(DEBUG_APPERROR, "  benchmarks:");
+    for (i = 0; benchmarks[i].name; i++)
+	debug(DEBUG_APPERROR, "    %s", benchmarks[i].name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char * log;
+    int first, last;
+    int i, j;
+
+    debuglvl = DEBUG_APPERROR|DEBUG_SYSERROR;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++)
+    {
+	if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+	{
+	    min_time = atof(argv[++i]);
+	    continue;
+	}
+
+	usage(argv[i], "");
+	exit(1);
+    }
+
+    if (i >= argc)
+    {
+	usage(NULL, NULL);
+	exit(1);
+    }
+
+    first = i;
+    last = argc - 1;
+    log = argv[last];
+
+    for (i = first; i < last; i++)
+    {
+	for (j = 0; benchmarks[j].name; j++)
+	    if (strcmp(argv[i], benchmarks[j].name) == 0)
+		break;
+
+	if (!benchmarks[j].name)
+	{
+	    usage("unknown benchmark", argv[i]);
+	    exit(1);
+	}
+    }
+
+    mb_load_corpus(log);
+    collect_keys();
+
+    printf("corpus %s: %d files, %d patch sets, %d members\n", log, num_files, num_patch_sets, num_members);
+    printf("%-24s %10s %12s %12s\n", "benchmark", "ops", "ns/op", "allocs/op");
+
+    for (j = 0; benchmarks[j].name; j++)
+    {
+	long ops;
+
+	if (first < last)
+	{
+	    for (i = first; i < last; i++)
+		if (strcmp(argv[i], benchmarks[j].name) == 0)
+		    break;
+
+	    if (i == last)
+		continue;
+	}
+
+	switch (benchmarks[j].per)
+	{
+	case 1:
+	    ops = num_files;
+	    break;
+	case 2:
+	    ops = num_patch_sets;
+	    break;
+	default:
+	    ops = num_members;
+	    break;
+	}
+
+	/* get_string interns two strings per member */
+	if (benchmarks[j].bench == bench_get_string)
+	    ops *= 2;
+
+	run(benchmarks[j].name, ops, benchmarks[j].setup, benchmarks[j].bench);
+    }
+
+    exit(0);
+}
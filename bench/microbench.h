@@ -0,0 +1,23 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <cbtcommon/list.h>
+
+#include "cvsps_types.h"
+
+/* mb_cvsps.c */
+void mb_load_corpus(const char *);
+int mb_compare_rev_strings(const char *, const char *);
+int mb_compare_patch_sets_bytime_list(struct list_link *, struct list_link *);
+list_head * mb_all_patch_sets();
+void mb_reset_ps_tree();
+
+/* mb_cache.c */
+void mb_parse_cache_revision(PatchSetMember *, const char *);
+
+#endif /* MICROBENCH_H */
@@ -0,0 +1,762 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * A stand-in CVS pserver for benchmarking and testing cvs_direct without
+ * a real repository.  It speaks enough of the protocol for cvsps:  the
+ * pserver auth handshake, valid-requests, version, Gzip-stream, rlog,
+ * co (with or without -p), diff and rdiff.
+ *
+ * rlog output is replayed from a recorded 'cvs rlog' (or generated)
+ * fixture, restricted to the paths asked for (not recursing with -l),
+ * or just the rcs file names with -R.  co output comes from
+ * <dir>/<file>@<rev> if a fixture directory is given and that file
+ * exists, otherwise it is synthetic:
+ * a first line naming the file and revision followed by filler lines,
+ * so any two revisions differ in exactly the first line, and the
+ * synthetic diffs agree with the synthetic co output.  A checked out
+ * file is executable if its fixture file is, or (synthetic) if its name
+ * ends in '.sh'.
+ *
+ * Each connection is handled in its own process.  Latency (added before
+ * every response) and bandwidth (applied to the bytes on the wire) can
+ * be set to model a remote server reproducibly.
+ *
+ * usage: pserver_stub [-p port] [-r rlog_fixture] [-c co_fixture_dir]
+ *                     [-s revision_size] [-l latency_ms] [-b kbytes_per_sec]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <cbtcommon/debug.h>
+#include <cbtcommon/tcpsocket.h>
+#include <cbtcommon/sio.h>
+
+#define RD_BUFF_SIZE 4096
+#define OUT_FLUSH_SIZE 65536
+#define MAX_ARGS 256
+
+typedef struct _Conn
+{
+    int fd;
+
+    /* buffered, possibly compressed, input */
+    char read_buff[RD_BUFF_SIZE];
+    char * head;
+    char * tail;
+    char zread_buff[RD_BUFF_SIZE];
+
+    /* response being built */
+    char * out;
+    int out_len;
+    int out_max;
+
+    int compressed;
+    z_stream zin;
+    z_stream zout;
+
+    int have_mbinary;
+    char * args[MAX_ARGS];
+    int num_args;
+} Conn;
+
+static unsigned short port = 12401;
+static const char * rlog_fixture;
+static const char * co_fixture_dir;
+static int revision_size = 1024;
+static int latency_ms;
+static int bandwidth_kbs;
+
+static void usage(const char * msg)
+{
+    if (msg)
+	debug(DEBUG_APPERROR, "%s", msg);
+
+    debug(DEBUG_APPERROR, "Usage: pserver_stub [-p port] [-r rlog_fixture] [-c co_fixture_dir]");
+    debug(DEBUG_APPERROR, "                    [-s revision_size] [-l latency_ms] [-b kbytes_per_sec]");
+    exit(1);
+}
+
+static int read_line(Conn * conn, char * p, int max)
+{
+    int len = 0;
+
+    while (1)
+    {
+	if (conn->head == conn->tail)
+	{
+	    int n;
+
+	    conn->head = conn->tail = conn->read_buff;
+
+	    if (conn->compressed)
+	    {
+		int ret;
+
+		if (conn->zin.avail_in == 0)
+		{
+		    if ((n = read(conn->fd, conn->zread_buff, RD_BUFF_SIZE)) <= 0)
+			return -1;
+
+		    conn->zin.next_in = (Bytef *)conn->zread_buff;
+		    conn->zin.avail_in = n;
+		}
+
+		conn->zin.next_out = (Bytef *)conn->read_buff;
+		conn->zin.avail_out = RD_BUFF_SIZE;
+
+		ret = inflate(&conn->zin, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR)
+		    return -1;
+
+		conn->tail = conn->read_buff + (RD_BUFF_SIZE - conn->zin.avail_out);
+	    }
+	    else
+	    {
+		if ((n = read(conn->fd, conn->read_buff, RD_BUFF_SIZE)) <= 0)
+		    return -1;
+
+		conn->tail = conn->read_buff + n;
+	    }
+
+	    continue;
+	}
+
+	if (*conn->head == '\n')
+	{
+	    conn->head++;
+	    break;
+	}
+
+	if (len < max - 1)
+	    p[len++] = *conn->head;
+
+	conn->head++;
+    }
+
+    p[len] = 0;
+    return len;
+}
+
+/* write to the socket no faster than the configured bandwidth */
+static void throttled_write(Conn * conn, const char * buff, int len)
+{
+    while (len > 0)
+    {
+	int n = (len > RD_BUFF_SIZE) ? RD_BUFF_SIZE : len;
+
+	if (writen(conn->fd, buff, n) != n)
+	{
+	    debug(DEBUG_SYSERROR, "pserver_stub: write failed");
+	    exit(1);
+	}
+
+	if (bandwidth_kbs > 0)
+	    usleep((long long)n * 1000000 / (bandwidth_kbs * 1024));
+
+	buff += n;
+	len -= n;
+    }
+}
+
+static void flush_out(Conn * conn)
+{
+    if (conn->out_len == 0)
+	return;
+
+    if (conn->compressed)
+    {
+	char zbuff[RD_BUFF_SIZE];
+
+	conn->zout.next_in = (Bytef *)conn->out;
+	conn->zout.avail_in = conn->out_len;
+
+	do
+	{
+	    conn->zout.next_out = (Bytef *)zbuff;
+	    conn->zout.avail_out = RD_BUFF_SIZE;
+
+	    if (deflate(&conn->zout, Z_SYNC_FLUSH) != Z_OK)
+	    {
+		debug(DEBUG_APPERROR, "pserver_stub: deflate failed");
+		exit(1);
+	    }
+
+	    throttled_write(conn, zbuff, RD_BUFF_SIZE - conn->zout.avail_out);
+	}
+	while (conn->zout.avail_out == 0);
+    }
+    else
+    {
+	throttled_write(conn, conn->out, conn->out_len);
+    }
+
+    conn->out_len = 0;
+}
+
+static void out_bytes(Conn * conn, const char * buff, int len)
+{
+    if (conn->out_len + len > conn->out_max)
+    {
+	while (conn->out_len + len > conn->out_max)
+	    conn->out_max = conn->out_max ? conn->out_max * 2 : OUT_FLUSH_SIZE;
+
+	if (!(conn->out = (char *)realloc(conn->out, conn->out_max)))
+	{
+	    debug(DEBUG_SYSERROR, "pserver_stub: malloc failed");
+	    exit(1);
+	}
+    }
+
+    memcpy(conn->out + conn->out_len, buff, len);
+    conn->out_len += len;
+
+    if (conn->out_len >= OUT_FLUSH_SIZE)
+	flush_out(conn);
+}
+
+static void out_string(Conn * conn, const char * fmt, ...)
+{
+    char buff[BUFSIZ];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buff, BUFSIZ, fmt, ap);
+    va_end(ap);
+
+    if (len >= BUFSIZ)
+	len = BUFSIZ - 1;
+
+    out_bytes(conn, buff, len);
+}
+
+static void clear_args(Conn * conn)
+{
+    int i;
+
+    for (i = 0; i < conn->num_args; i++)
+	free(conn->args[i]);
+
+    conn->num_args = 0;
+}
+
+/*
+ * pick the revisions (-r) and the file (last non-option argument)
+ * out of the arguments of a co, diff or rdiff request
+ */
+static const char * parse_args(Conn * conn, const char ** rev1, const char ** rev2)
+{
+    const char * file = NULL;
+    int i;
+
+    *rev1 = *rev2 = NULL;
+
+    for (i = 0; i < conn->num_args; i++)
+    {
+	const char * arg = conn->args[i];
+
+	if (strncmp(arg, "-r", 2) == 0)
+	{
+	    const char * rev = arg[2] ? arg + 2 : (i + 1 < conn->num_args ? conn->args[++i] : "");
+
+	    if (!*rev1)
+		*rev1 = rev;
+	    else
+		*rev2 = rev;
+	}
+	else if (strcmp(arg, "-d") == 0 || strcmp(arg, "-D") == 0)
+	{
+	    i++;
+	}
+	else if (arg[0] != '-')
+	{
+	    file = arg;
+	}
+    }
+
+    if (!*rev1)
+	*rev1 = "1.1";
+    if (!*rev2)
+	*rev2 = *rev1;
+
+    return file ? file : "unknown";
+}
+
+static void send_latency()
+{
+    if (latency_ms > 0)
+	usleep(latency_ms * 1000);
+}
+
+/*
+ * Does the rlog section for rcs file 'rcs' (relative to the root) match
+ * one of the requested paths?  A path names a file or directory in the
+ * module, as in 'cvs rlog mod/dir', and Attic files are under their
+ * directory.  With 'local' (-l) a directory only matches the files
+ * directly in it.  No paths at all means the whole repository.
+ */
+static int rlog_path_match(const char * rcs, char ** paths, int num_paths, int local)
+{
+    char name[BUFSIZ];
+    const char * attic;
+    int i, len;
+
+    if (num_paths == 0)
+	return 1;
+
+    snprintf(name, BUFSIZ, "%s", rcs);
+    len = strlen(name);
+    if (len > 2 && strcmp(name + len - 2, ",v") == 0)
+	name[len - 2] = 0;
+
+    if ((attic = strstr(name, "/Attic/")))
+	memmove(name + (attic - name), name + (attic - name) + 6, strlen(attic + 6) + 1);
+
+    for (i = 0; i < num_paths; i++)
+    {
+	len = strlen(paths[i]);
+	if (strncmp(name, paths[i], len) != 0)
+	    continue;
+
+	if (name[len] == 0 || (name[len] == '/' && (!local || !strchr(name + len + 1, '/'))))
+	    return 1;
+    }
+
+    return 0;
+}
+
+static void do_rlog(Conn * conn)
+{
+    char buff[BUFSIZ];
+    char * paths[MAX_ARGS];
+    int num_paths = 0, names_only = 0, local = 0, in_section = 0, i;
+    FILE * fp;
+
+    if (!rlog_fixture || !(fp = fopen(rlog_fixture, "r")))
+    {
+	out_string(conn, "E cvs rlog: no rlog fixture\n");
+	out_string(conn, "error  \n");
+	return;
+    }
+
+    /* -R lists the rcs files only, -l doesn't recurse, -d takes a date */
+    for (i = 0; i < conn->num_args; i++)
+    {
+	if (strcmp(conn->args[i], "-R") == 0)
+	    names_only = 1;
+	else if (strcmp(conn->args[i], "-l") == 0)
+	    local = 1;
+	else if (strcmp(conn->args[i], "-d") == 0)
+	    i++;
+	else if (conn->args[i][0] != '-')
+	    paths[num_paths++] = conn->args[i];
+    }
+
+    while (fgets(buff, BUFSIZ, fp))
+    {
+	if (strncmp(buff, "RCS file: /cvsroot/", 19) == 0)
+	{
+	    buff[strcspn(buff, "\n")] = 0;
+	    in_section = rlog_path_match(buff + 19, paths, num_paths, local);
+
+	    if (in_section && names_only)
+		out_string(conn, "M /cvsroot/%s\n", buff + 19);
+	    else if (in_section)
+		out_string(conn, "M %s\n", buff);
+	    continue;
+	}
+
+	if (!in_section || names_only)
+	    continue;
+
+	out_string(conn, "M %s", buff);
+	if (buff[strlen(buff) - 1] != '\n')
+	    out_string(conn, "\n");
+    }
+
+    fclose(fp);
+    out_string(conn, "ok\n");
+}
+
+/*
+ * Fill 'buff' with the contents of file:rev, returns the length
+ */
+static int get_revision(const char * file, const char * rev, char ** buff)
+{
+    char path[PATH_MAX];
+    FILE * fp;
+    int len, max, i;
+
+    if (co_fixture_dir)
+    {
+	snprintf(path, PATH_MAX, "%s/%s@%s", co_fixture_dir, file, rev);
+
+	if ((fp = fopen(path, "r")))
+	{
+	    len = 0;
+	    max = BUFSIZ;
+	    *buff = (char *)malloc(max);
+
+	    while (*buff && (i = fread(*buff + len, 1, max - len, fp)) > 0)
+	    {
+		len += i;
+		if (len == max)
+		    *buff = (char *)realloc(*buff, max *= 2);
+	    }
+
+	    fclose(fp);
+	    return len;
+	}
+    }
+
+    max = revision_size + BUFSIZ;
+    if (!(*buff = (char *)malloc(max)))
+    {
+	debug(DEBUG_SYSERROR, "pserver_stub: malloc failed");
+	exit(1);
+    }
+
+    len = snprintf(*buff, max, "%s revision %s\n", file, rev);
+
+    for (i = 2; len < revision_size; i++)
+	len += snprintf(*buff + len, max - len, "line %d of %s\n", i, file);
+
+    return len;
+}
+
+/*
+ * Is file:rev executable when checked out?
+ */
+static int get_executable(const char * file, const char * rev)
+{
+    char path[PATH_MAX];
+    struct stat sbuf;
+    int len;
+
+    if (co_fixture_dir)
+    {
+	snprintf(path, PATH_MAX, "%s/%s@%s", co_fixture_dir, file, rev);
+
+	if (stat(path, &sbuf) == 0)
+	    return (sbuf.st_mode & S_IXUSR) != 0;
+    }
+
+    len = strlen(file);
+    return (len > 3 && strcmp(file + len - 3, ".sh") == 0);
+}
+
+static void do_co(Conn * conn)
+{
+    const char * rev1, * rev2;
+    const char * file = parse_args(conn, &rev1, &rev2);
+    char * buff, * p, * end;
+    int len = get_revision(file, rev1, &buff);
+    int pipe_out = 0, i;
+
+    for (i = 0; i < conn->num_args; i++)
+	if (strcmp(conn->args[i], "-p") == 0)
+	    pipe_out = 1;
+
+    if (!pipe_out)
+    {
+	const char * name = (p = strrchr(file, '/')) ? p + 1 : file;
+
+	/* the pathname, repository file, entries line, mode and length */
+	out_string(conn, "Created %.*s\n", (int)(name - file), file);
+	out_string(conn, "/cvsroot/%s\n", file);
+	out_string(conn, "/%s/%s///\n", name, rev1);
+	out_string(conn, "%s\n", get_executable(file, rev1) ? "u=rwx,g=rx,o=rx" : "u=rw,g=r,o=r");
+	out_string(conn, "%d\n", len);
+	out_bytes(conn, buff, len);
+	out_string(conn, "M U %s\n", file);
+    }
+    else if (conn->have_mbinary && memchr(buff, 0, len))
+    {
+	out_string(conn, "Mbinary\n%d\n", len);
+	out_bytes(conn, buff, len);
+    }
+    else
+    {
+	for (p = buff; p < buff + len; p = end + 1)
+	{
+	    if (!(end = memchr(p, '\n', buff + len - p)))
+		end = buff + len;
+
+	    out_string(conn, "M ");
+	    out_bytes(conn, p, end - p);
+	    out_string(conn, "\n");
+	}
+    }
+
+    free(buff);
+    out_string(conn, "ok\n");
+}
+
+/*
+ * Synthetic diffs only ever change the first line, so this matches
+ * what diff(1) says about two synthetic revisions
+ */
+static void do_diff(Conn * conn, int rdiff)
+{
+    const char * rev1, * rev2;
+    const char * file = parse_args(conn, &rev1, &rev2);
+    char * buff, * end, * context, * p;
+    int len = get_revision(file, rev1, &buff);
+    int ctx_lines = 0, i;
+
+    /* fixture files need not end in a newline, or have one at all */
+    end = buff + len;
+    p = memchr(buff, '\n', len);
+    context = p ? p + 1 : end;
+
+    if (rdiff)
+    {
+	out_string(conn, "M Index: %s\n", file);
+	out_string(conn, "M diff -u %s:%s %s:%s\n", file, rev1, file, rev2);
+	out_string(conn, "M --- %s:%s\tThu Jan  1 00:00:00 1970\n", file, rev1);
+	out_string(conn, "M +++ %s:%s\tThu Jan  1 00:00:00 1970\n", file, rev2);
+    }
+    else
+    {
+	out_string(conn, "M Index: %s\n", file);
+	out_string(conn, "M ===================================================================\n");
+	out_string(conn, "M RCS file: /cvsroot/%s,v\n", file);
+	out_string(conn, "M retrieving revision %s\n", rev1);
+	out_string(conn, "M retrieving revision %s\n", rev2);
+	out_string(conn, "M diff -u -r%s -r%s\n", rev1, rev2);
+	out_string(conn, "M --- %s\t1 Jan 1970 00:00:00 -0000\t%s\n", file, rev1);
+	out_string(conn, "M +++ %s\t1 Jan 1970 00:00:00 -0000\t%s\n", file, rev2);
+    }
+
+    /* the lines after the first, which differs, are context */
+    for (p = context, i = 0; i < 3 && p < end; i++)
+    {
+	char * eol = memchr(p, '\n', end - p);
+
+	ctx_lines++;
+	p = eol ? eol + 1 : end;
+    }
+
+    out_string(conn, "M @@ -1,%d +1,%d @@\n", ctx_lines + 1, ctx_lines + 1);
+    out_string(conn, "M -%s revision %s\n", file, rev1);
+    out_string(conn, "M +%s revision %s\n", file, rev2);
+
+    for (p = context, i = 0; i < ctx_lines; i++)
+    {
+	char * eol = memchr(p, '\n', end - p);
+
+	if (!eol)
+	    eol = end;
+
+	out_string(conn, "M  ");
+	out_bytes(conn, p, eol - p);
+	out_string(conn, "\n");
+	p = eol + 1;
+    }
+
+    free(buff);
+
+    /* 'cvs diff' reports 'files differ' as an error */
+    out_string(conn, rdiff ? "ok\n" : "error  \n");
+}
+
+static void serve(int fd)
+{
+    Conn conn;
+    char line[BUFSIZ];
+
+    memset(&conn, 0, sizeof(conn));
+    conn.fd = fd;
+    conn.head = conn.tail = conn.read_buff;
+
+    /* the pserver handshake: root, user and password are not checked */
+    if (read_line(&conn, line, BUFSIZ) < 0 ||
+	(strcmp(line, "BEGIN AUTH REQUEST") != 0 && strcmp(line, "BEGIN VERIFICATION REQUEST") != 0))
+    {
+	debug(DEBUG_APPERROR, "pserver_stub: bad auth request");
+	exit(1);
+    }
+
+    do
+    {
+	if (read_line(&conn, line, BUFSIZ) < 0)
+	    exit(1);
+    }
+    while (strncmp(line, "END ", 4) != 0);
+
+    send_latency();
+    out_string(&conn, "I LOVE YOU\n");
+    flush_out(&conn);
+
+    while (read_line(&conn, line, BUFSIZ) >= 0)
+    {
+	debug(DEBUG_TCP, "pserver_stub: request '%s'", line);
+
+	if (strncmp(line, "Argument ", 9) == 0)
+	{
+	    if (conn.num_args < MAX_ARGS)
+		conn.args[conn.num_args++] = strdup(line + 9);
+	    continue;
+	}
+
+	if (strncmp(line, "Valid-responses ", 16) == 0)
+	{
+	    conn.have_mbinary = (strstr(line, " Mbinary ") != NULL);
+	    continue;
+	}
+
+	if (strncmp(line, "Directory ", 10) == 0)
+	{
+	    /* followed by the repository directory */
+	    read_line(&conn, line, BUFSIZ);
+	    continue;
+	}
+
+	if (strncmp(line, "Root ", 5) == 0 || strcmp(line, "UseUnchanged") == 0 ||
+	    strncmp(line, "Argumentx ", 10) == 0)
+	    continue;
+
+	if (strncmp(line, "Gzip-stream ", 12) == 0)
+	{
+	    conn.compressed = 1;
+
+	    if (deflateInit(&conn.zout, atoi(line + 12)) != Z_OK || inflateInit(&conn.zin) != Z_OK)
+	    {
+		debug(DEBUG_APPERROR, "pserver_stub: zlib init failed");
+		exit(1);
+	    }
+
+	    /* anything already buffered arrived compressed */
+	    if (conn.head != conn.tail)
+	    {
+		int n = conn.tail - conn.head;
+		memcpy(conn.zread_buff, conn.head, n);
+		conn.zin.next_in = (Bytef *)conn.zread_buff;
+		conn.zin.avail_in = n;
+		conn.head = conn.tail = conn.read_buff;
+	    }
+	    continue;
+	}
+
+	send_latency();
+
+	if (strcmp(line, "valid-requests") == 0)
+	{
+	    out_string(&conn, "Valid-requests Root Valid-responses valid-requests Directory Argument Argumentx UseUnchanged Gzip-stream version rlog co diff rdiff\n");
+	    out_string(&conn, "ok\n");
+	}
+	else if (strcmp(line, "version") == 0)
+	{
+	    out_string(&conn, "M Concurrent Versions System (CVS) 1.11.23 (pserver_stub)\n");
+	    out_string(&conn, "ok\n");
+	}
+	else if (strcmp(line, "rlog") == 0)
+	{
+	    do_rlog(&conn);
+	}
+	else if (strcmp(line, "co") == 0)
+	{
+	    do_co(&conn);
+	}
+	else if (strcmp(line, "diff") == 0 || strcmp(line, "rdiff") == 0)
+	{
+	    do_diff(&conn, line[0] == 'r');
+	}
+	else
+	{
+	    out_string(&conn, "error  unrecognized request `%s'\n", line);
+	}
+
+	clear_args(&conn);
+	flush_out(&conn);
+    }
+
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int i = 1;
+    int sockfd;
+
+    debuglvl = DEBUG_APPERROR|DEBUG_SYSERROR|DEBUG_APPMSG1;
+
+    while (i < argc)
+    {
+	if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+	    port = atoi(argv[i + 1]);
+	else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+	    rlog_fixture = argv[i + 1];
+	else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+	    co_fixture_dir = argv[i + 1];
+	else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+	    revision_size = atoi(argv[i + 1]);
+	else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+	    latency_ms = atoi(argv[i + 1]);
+	else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+	    bandwidth_kbs = atoi(argv[i + 1]);
+	else if (strcmp(argv[i], "--debuglvl") == 0 && i + 1 < argc)
+	    debuglvl = atoi(argv[i + 1]);
+	else
+	    usage(NULL);
+
+	i += 2;
+    }
+
+    /* connections are served by children, don't leave zombies around */
+    signal(SIGCHLD, SIG_IGN);
+
+    if ((sockfd = tcp_create_socket(REUSE_ADDR)) < 0 || tcp_bind_and_listen(sockfd, port) < 0)
+    {
+	debug(DEBUG_APPERROR, "pserver_stub: can't listen on port %d", port);
+	exit(1);
+    }
+
+    debug(DEBUG_APPMSG1, "pserver_stub: listening on port %d", port);
+
+    while (1)
+    {
+	int fd = tcp_accept_connection(sockfd);
+	pid_t pid;
+
+	if (fd < 0)
+	{
+	    if (errno == EINTR)
+		continue;
+
+	    debug(DEBUG_SYSERROR, "pserver_stub: accept failed");
+	    exit(1);
+	}
+
+	if ((pid = fork()) < 0)
+	{
+	    debug(DEBUG_SYSERROR, "pserver_stub: fork failed");
+	    close(fd);
+	    continue;
+	}
+
+	if (pid == 0)
+	{
+	    close(sockfd);
+	    serve(fd);
+	}
+
+	close(fd);
+    }
+
+    return 0;
+}
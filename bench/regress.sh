@@ -0,0 +1,231 @@
+#!/bin/sh
+#
+# End to end regression check.  cvsps is run over a set of rlog corpora
+# with several option sets, and for each run the patchset output is
+# compared with a golden copy, and the wall time and peak RSS (taken from
+# the --profile report) with the ones recorded alongside it.  A run fails
+# if the output differs in any way, or if it is slower or bigger than the
+# recorded run by more than the tolerance.
+#
+# The golden outputs, bench/golden/*.out, are part of the tree.  They
+# were recorded with the unmodified cvsps 2.1 of this fork, whose output
+# is the reference.  The generated corpora are seeded, so they come out
+# the same everywhere.  Only deliberate output changes should re-record
+# them:
+#
+#   sh bench/regress.sh --update-output
+#
+# Timings depend on the machine, so the *.perf files are kept local and
+# are not checked in.  Record them with a known good binary first,
+#
+#   sh bench/regress.sh --update
+#
+# and then check a modified binary with
+#
+#   sh bench/regress.sh
+#
+# Without *.perf files only the output is checked.
+#
+# The option sets are the default, -z 600, -A, -r <tag>, -b <branch> and
+# cache, which runs with -u twice in the same home directory, so the
+# second run starts from whatever the first left in ~/.cvsps, and
+# requires both to print the same.  The tag and branch are the first ones
+# found in the symbolic names of the corpus.
+#
+# Environment:
+#   CVSPS          the cvsps binary to check (./cvsps)
+#   CORPORA        rlog files to use instead of the generated corpora
+#   TIME_TOLERANCE allowed wall time increase in percent (20)
+#   RSS_TOLERANCE  allowed peak RSS increase in percent (10)
+#   TIME_SLACK     allowed absolute wall time increase in seconds (0.05)
+
+BENCH_DIR=`dirname $0`
+CVSPS=${CVSPS:-./cvsps}
+CORPUS_DIR=$BENCH_DIR/corpus
+GOLDEN_DIR=$BENCH_DIR/golden
+TIME_TOLERANCE=${TIME_TOLERANCE:-20}
+RSS_TOLERANCE=${RSS_TOLERANCE:-10}
+TIME_SLACK=${TIME_SLACK:-0.05}
+WORK=`mktemp -d /tmp/cvsps-regress.XXXXXX` || exit 1
+
+trap 'rm -rf $WORK' 0
+
+update=
+case "$1" in
+--update)        update=perf ;;
+--update-output) update=output ;;
+esac
+
+# generated corpora, kept in bench/corpus like the benchmark ones
+corpus_opts()
+{
+    case $1 in
+    regress-linear) echo "--files 300 --revs 6 --seed 11" ;;
+    regress-branchy) echo "--files 500 --revs 8 --branches 8 --branch-depth 3 --tags 30 --vendor 100 --seed 12" ;;
+    esac
+}
+
+# value of a top level "key": number in the "total" line of the profile
+total_field()
+{
+    sed -n "s/.*\"total\": {.*\"$1\": \([0-9]*\).*/\1/p" $2
+}
+
+# first tag (symbolic name on a revision) or branch (on a magic branch
+# number) named in the log
+first_symbol()
+{
+    awk -v want=$2 '/^\t[^ :]+: [0-9.]+$/ {
+	    sym = substr($1, 1, length($1) - 1)
+	    isbranch = ($2 ~ /\.0\.[0-9]+$/)
+	    if ((want == "branch") == isbranch) { print sym; exit }
+	}' $1
+}
+
+# run_cvsps <corpus> <home> <output> <profile> <options>...
+# the dates are printed in local time, so the zone is fixed.  The
+# profile is not asked for when recording the output, the reference
+# binary predates --profile
+run_cvsps()
+{
+    corpus=$1
+    home=$2
+    out=$3
+    profile=$4
+    shift 4
+
+    if [ "$update" != output ]
+    then
+	set -- --profile $profile "$@"
+    fi
+
+    HOME=$home TZ=UTC $CVSPS --root /cvsroot --test-log $corpus "$@" mod > $out 2> $WORK/err
+    if [ $? -ne 0 ]
+    then
+	echo "cvsps failed on $corpus with $*:" >&2
+	cat $WORK/err >&2
+	return 1
+    fi
+}
+
+if [ -z "$CORPORA" ]
+then
+    mkdir -p $CORPUS_DIR || exit 1
+    for name in regress-linear regress-branchy
+    do
+	if [ ! -f $CORPUS_DIR/$name.log ]
+	then
+	    perl $BENCH_DIR/gen_corpus.pl `corpus_opts $name` --output $CORPUS_DIR/$name.log.tmp &&
+		mv $CORPUS_DIR/$name.log.tmp $CORPUS_DIR/$name.log || exit 1
+	fi
+	CORPORA="$CORPORA $CORPUS_DIR/$name.log"
+    done
+fi
+
+mkdir -p $GOLDEN_DIR || exit 1
+
+failed=0
+[ "$update" = output ] ||
+printf "%-24s %-10s %-6s %10s %10s %12s %12s\n" corpus options result wall_s base_s peak_rss_kb base_rss_kb
+
+for corpus in $CORPORA
+do
+    name=`basename $corpus .log`
+    tag=`first_symbol $corpus tag`
+    branch=`first_symbol $corpus branch`
+
+    for set in default fuzz ancestry tag branch cache
+    do
+	home=$WORK/home.$set
+	rm -rf $home
+	mkdir $home || exit 1
+
+	case $set in
+	default)  opts="-x" ;;
+	fuzz)     opts="-x -z 600" ;;
+	ancestry) opts="-x -A" ;;
+	tag)      [ -n "$tag" ] || continue; opts="-x -r $tag" ;;
+	branch)   [ -n "$branch" ] || continue; opts="-x -b $branch" ;;
+	cache)    opts="-u"
+		  run_cvsps $corpus $home $WORK/first $WORK/profile.json $opts || { failed=1; continue; } ;;
+	esac
+
+	run_cvsps $corpus $home $WORK/out $WORK/profile.json $opts || { failed=1; continue; }
+
+	golden=$GOLDEN_DIR/$name.$set
+
+	if [ "$update" = output ]
+	then
+	    cp $WORK/out $golden.out || exit 1
+	    echo "$name $set: recorded `wc -l < $golden.out` lines"
+	    continue
+	fi
+
+	wall=`total_field wall_usec $WORK/profile.json`
+	rss=`sed -n 's/.*"peak_rss_kb": \([0-9]*\).*/\1/p' $WORK/profile.json`
+
+	if [ "$update" = perf ]
+	then
+	    echo "$wall $rss" > $golden.perf
+	    echo $name $set recorded $wall 0 $rss 0 |
+		awk '{ printf "%-24s %-10s %-6s %10.3f %10s %12d %12s\n", $1, $2, $3, $4 / 1e6, "-", $6, "-" }'
+	    continue
+	fi
+
+	if [ ! -f $golden.out ]
+	then
+	    echo "no golden output for $name $set" >&2
+	    failed=1
+	    continue
+	fi
+
+	result=ok
+
+	if [ $set = cache ] && ! cmp -s $WORK/first $WORK/out
+	then
+	    echo "$name $set: second -u run differs from the first:" >&2
+	    diff -u $WORK/first $WORK/out | head -20 >&2
+	    result=OUTPUT
+	fi
+
+	if ! cmp -s $golden.out $WORK/out
+	then
+	    echo "$name $set: output differs from $golden.out:" >&2
+	    diff -u $golden.out $WORK/out | head -20 >&2
+	    result=OUTPUT
+	fi
+
+	if [ -f $golden.perf ]
+	then
+	    read base_wall base_rss < $golden.perf
+	else
+	    base_wall=0
+	    base_rss=0
+	fi
+
+	perf=`echo $wall $base_wall $rss $base_rss $TIME_TOLERANCE $TIME_SLACK $RSS_TOLERANCE | awk '{
+	    slow = ($1 / 1e6 > $2 / 1e6 * (1 + $5 / 100) + $6)
+	    big = ($3 > $4 * (1 + $7 / 100))
+	    if (!$2) print "ok"; else print (slow ? "TIME" : (big ? "RSS" : "ok"))
+	}'`
+
+	if [ $result = ok ]
+	then
+	    result=$perf
+	fi
+
+	if [ $result != ok ]
+	then
+	    failed=1
+	fi
+
+	echo $name $set $result $wall $base_wall $rss $base_rss |
+	    awk '{ printf "%-24s %-10s %-6s %10.3f %10.3f %12d %12d\n", $1, $2, $3, $4 / 1e6, $5 / 1e6, $6, $7 }'
+    done
+done
+
+if [ $failed -ne 0 ]
+then
+    echo "regression check FAILED" >&2
+    exit 1
+fi
@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Run cvsps over synthetic corpora of standard sizes and record wall time,
+# CPU time and peak RSS (taken from the --profile report) for each.  The
+# corpora are generated by gen_corpus.pl on first use and kept in
+# bench/corpus.  One line per run is appended to bench/results.txt.
+#
+# Environment:
+#   CVSPS      the cvsps binary to measure (./cvsps)
+#   SIZES      which sizes to run (small medium large)
+#   CVSPS_OPTS extra options for cvsps (e.g. "-A" or "-z 600")
+
+BENCH_DIR=`dirname $0`
+CVSPS=${CVSPS:-./cvsps}
+SIZES=${SIZES:-"small medium large"}
+CORPUS_DIR=$BENCH_DIR/corpus
+RESULTS=$BENCH_DIR/results.txt
+WORK=`mktemp -d /tmp/cvsps-bench.XXXXXX` || exit 1
+
+trap 'rm -rf $WORK' 0
+
+size_opts()
+{
+    case $1 in
+    small)  echo "--files 1000 --revs 8" ;;
+    medium) echo "--files 10000 --revs 8 --branches 8 --tags 40" ;;
+    large)  echo "--files 50000 --revs 10 --branches 16 --tags 100" ;;
+    *)      echo "unknown size $1" >&2; exit 1 ;;
+    esac
+}
+
+# value of a top level "key": number in the "total" line of the profile
+total_field()
+{
+    sed -n "s/.*\"total\": {.*\"$1\": \([0-9]*\).*/\1/p" $2
+}
+
+mkdir -p $CORPUS_DIR || exit 1
+
+rev=`git rev-parse --short HEAD 2>/dev/null || echo unknown`
+now=`date -u +%Y-%m-%dT%H:%M:%SZ`
+
+printf "%-8s %10s %10s %12s %10s\n" size wall_s cpu_s peak_rss_kb patchsets
+
+for size in $SIZES
+do
+    opts=`size_opts $size` || exit 1
+    corpus=$CORPUS_DIR/$size.log
+
+    if [ ! -f $corpus ]
+    then
+	perl $BENCH_DIR/gen_corpus.pl $opts --output $corpus.tmp && mv $corpus.tmp $corpus || exit 1
+    fi
+
+    HOME=$WORK $CVSPS --root /cvsroot -x --test-log $corpus --profile $WORK/profile.json \
+	$CVSPS_OPTS mod > $WORK/out 2> $WORK/err
+    if [ $? -ne 0 ]
+    then
+	echo "cvsps failed on $size corpus:" >&2
+	cat $WORK/err >&2
+	exit 1
+    fi
+
+    wall=`total_field wall_usec $WORK/profile.json`
+    cpu=`total_field cpu_usec $WORK/profile.json`
+    rss=`sed -n 's/.*"peak_rss_kb": \([0-9]*\).*/\1/p' $WORK/profile.json`
+    patchsets=`grep -c '^PatchSet' $WORK/out`
+
+    line=`echo $size $wall $cpu $rss $patchsets | awk '{ printf "%-8s %10.3f %10.3f %12d %10d", $1, $2 / 1e6, $3 / 1e6, $4, $5 }'`
+    echo "$line"
+    echo "$now $rev $line $CVSPS_OPTS" >> $RESULTS
+done
@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# Measure the cvs_direct protocol code against the stand-in pserver.
+# pserver_stub is started on the small corpus, and cvsps --cvs-direct
+# reads the rlog and generates the diffs of a range of patchsets over
+# it, once uncompressed and once with -Z.  Wall time and the bytes on
+# the wire (taken from the --cvs-stats report) are recorded for each.
+# One line per run is appended to bench/results.txt.
+#
+# Environment:
+#   CVSPS      the cvsps binary to measure (./cvsps)
+#   STUB       the pserver stub (bench/pserver_stub)
+#   PORT       the port to run the stub on (12401)
+#   PATCHSETS  the patchsets to diff (1-100)
+#   STUB_OPTS  extra options for the stub (e.g. "-l 5" for 5ms latency)
+#   CVSPS_OPTS extra options for cvsps
+
+BENCH_DIR=`dirname $0`
+CVSPS=${CVSPS:-./cvsps}
+STUB=${STUB:-$BENCH_DIR/pserver_stub}
+PORT=${PORT:-12401}
+PATCHSETS=${PATCHSETS:-1-100}
+CORPUS_DIR=$BENCH_DIR/corpus
+CORPUS=$CORPUS_DIR/small.log
+RESULTS=$BENCH_DIR/results.txt
+WORK=`mktemp -d /tmp/cvsps-stub-bench.XXXXXX` || exit 1
+
+stub_pid=
+trap '[ -n "$stub_pid" ] && kill $stub_pid; rm -rf $WORK' 0
+
+# value of a top level "key": number in the --cvs-stats report
+stats_field()
+{
+    sed -n "s/^  \"$1\": \([0-9]*\).*/\1/p" $2
+}
+
+mkdir -p $CORPUS_DIR || exit 1
+
+if [ ! -f $CORPUS ]
+then
+    perl $BENCH_DIR/gen_corpus.pl --files 1000 --revs 8 --output $CORPUS.tmp && mv $CORPUS.tmp $CORPUS || exit 1
+fi
+
+$STUB -p $PORT -r $CORPUS $STUB_OPTS 2> $WORK/stub.err &
+stub_pid=$!
+
+# wait for it to listen
+tries=0
+until grep -q listening $WORK/stub.err
+do
+    tries=`expr $tries + 1`
+    if [ $tries -gt 50 ] || ! kill -0 $stub_pid 2>/dev/null
+    then
+	echo "pserver_stub failed to start:" >&2
+	cat $WORK/stub.err >&2
+	exit 1
+    fi
+    sleep 0.1
+done
+
+rev=`git rev-parse --short HEAD 2>/dev/null || echo unknown`
+now=`date -u +%Y-%m-%dT%H:%M:%SZ`
+
+printf "%-8s %10s %12s %12s %10s\n" mode wall_s wire_in wire_out patchsets
+
+for mode in plain Z3
+do
+    case $mode in
+    plain) opts="" ;;
+    Z3)    opts="-Z 3" ;;
+    esac
+
+    start=`date +%s.%N`
+    HOME=$WORK $CVSPS -x --cvs-direct $opts --root :pserver:bench@localhost:$PORT/cvsroot \
+	-g -s $PATCHSETS --cvs-stats $WORK/stats.json $CVSPS_OPTS mod > $WORK/out 2> $WORK/err
+    if [ $? -ne 0 ]
+    then
+	echo "cvsps failed with $mode connection:" >&2
+	cat $WORK/err >&2
+	exit 1
+    fi
+    end=`date +%s.%N`
+
+    wire_in=`stats_field wire_bytes_in $WORK/stats.json`
+    wire_out=`stats_field wire_bytes_out $WORK/stats.json`
+    patchsets=`grep -c '^PatchSet' $WORK/out`
+
+    line=`echo $mode $start $end $wire_in $wire_out $patchsets | awk '{ printf "%-8s %10.3f %12d %12d %10d", $1, $3 - $2, $4, $5, $6 }'`
+    echo "$line"
+    echo "$now $rev stub $line $CVSPS_OPTS" >> $RESULTS
+done
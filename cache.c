@@ -19,6 +19,7 @@
 #include "cvsps_types.h"
 #include "cvsps.h"
 #include "util.h"
+#include "profile.h"
 
 #define CACHE_DESCR_BOUNDARY "-=-END CVSPS DESCR-=-\n"
 
@@ -157,6 +158,7 @@ time_t read_cache()
 		len -= 6;
 		f = create_cvsfile();
 		f->filename = xstrdup(buff + 6);
+		profile_bytes(PROF_FILE, strlen(f->filename) + 1);
 		f->filename[len-1] = 0; /* Remove the \n at the end of line */
 		debug(DEBUG_STATUS, "read cache filename '%s'", f->filename);
 		put_hash_object_ex(file_hash, f->filename, f, HT_NO_KEYCOPY, NULL, NULL);
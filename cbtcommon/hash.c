@@ -18,6 +18,11 @@ RCSID("$Id: hash.c,v 1.6 2003/05/07 15:42:38 david Exp $");
 static unsigned int hash_string(const char *);
 static struct hash_entry *scan_list(struct list_link *, const char *); 
 static struct hash_entry *get_hash_entry(struct hash_table *tbl, const char *key);
+static void free_hash_entry(struct hash_entry *);
+
+/* memory held by all hash tables, see get_hash_stats */
+static long num_hash_entries;
+static long hash_bytes;
 
 struct hash_table *create_hash_table(unsigned int sz)
 {
@@ -32,6 +37,8 @@ struct hash_table *create_hash_table(unsigned int sz)
 	return NULL;
     }
 	
+    hash_bytes += sizeof(*tbl) + sz*sizeof(struct list_link);
+
     tbl->ht_size  = sz;
     tbl->ht_lists = (struct list_link *)(tbl + 1);
     tbl->iterator = 0;
@@ -59,12 +66,13 @@ void destroy_hash_table(struct hash_table *tbl, void (*delete_obj)(void *))
 	    entry = list_entry(next, struct hash_entry, he_list);
 	    if (delete_obj)
 		delete_obj(entry->he_obj);
-	    free(entry);
+	    free_hash_entry(entry);
 
 	    next = tmp;
 	}
     }
 
+    hash_bytes -= sizeof(*tbl) + tbl->ht_size*sizeof(struct list_link);
     free(tbl);
 }
 
@@ -106,7 +114,7 @@ void *remove_hash_object(struct hash_table *tbl, const char *key)
     {
 	list_del(&entry->he_list);
 	retval = entry->he_obj;
-	free(entry);
+	free_hash_entry(entry);
     }
 
     return retval;
@@ -237,6 +245,9 @@ int put_hash_object_ex(struct hash_table *tbl, const char *key, void *obj, int c
 	    entry->he_obj = obj;
 
 	    list_add(&entry->he_list, head);
+
+	    num_hash_entries++;
+	    hash_bytes += s;
 	}
     }
 
@@ -262,11 +273,32 @@ void destroy_hash_table_ex(struct hash_table *tbl,
 	    entry = list_entry(next, struct hash_entry, he_list);
 	    if (delete_entry)
 		delete_entry(cookie, entry->he_key, entry->he_obj);
-	    free(entry);
+	    free_hash_entry(entry);
 
 	    next = tmp;
 	}
     }
 
+    hash_bytes -= sizeof(*tbl) + tbl->ht_size*sizeof(struct list_link);
     free(tbl);
 }
+
+static void free_hash_entry(struct hash_entry *entry)
+{
+    size_t s = sizeof(*entry);
+
+    /* a copied key lives right after the entry */
+    if (entry->he_key == (char *)(entry + 1))
+	s += strlen(entry->he_key) + 1;
+
+    num_hash_entries--;
+    hash_bytes -= s;
+    free(entry);
+}
+
+/* number of entries, and bytes used by all tables and entries */
+void get_hash_stats(long *entries, long *bytes)
+{
+    *entries = num_hash_entries;
+    *bytes = hash_bytes;
+}
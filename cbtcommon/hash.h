@@ -45,6 +45,8 @@ void destroy_hash_table_ex(struct hash_table *tbl, void (*delete_entry)(const vo
 void reset_hash_iterator(struct hash_table *tbl);
 struct hash_entry *next_hash_entry(struct hash_table *tbl);
 
+void get_hash_stats(long *entries, long *bytes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,312 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * Checkpointing of rlog ingestion.  While load_from_cvs() reads the log,
+ * every completed 'RCS file' section is appended verbatim to a side file
+ * next to the cache, ~/.cvsps/<root>#<repository>.checkpoint, which is
+ * flushed to disk periodically.  If the run dies before the log is fully
+ * read, the next run with the same query replays the saved sections
+ * through the parser first, which rebuilds the model state for those
+ * files.  The fresh log is then only asked for the parts of the
+ * repository with files left to read (see checkpoint_file_done()), and
+ * the sections in it that were loaded already are skipped.  The file is
+ * removed once the whole log has been read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cbtcommon/hash.h>
+#include <cbtcommon/debug.h>
+#include <cbtcommon/text_util.h>
+
+#include "checkpoint.h"
+#include "cvsps_types.h"
+#include "cvsps.h"
+#include "util.h"
+
+#define CHECKPOINT_VERSION 1
+
+/* sync the checkpoint after this many sections or seconds, whichever first */
+#define CHECKPOINT_SECTIONS 256
+#define CHECKPOINT_SECONDS 30
+
+#define CVS_FILE_BOUNDARY "=============================================================================\n"
+
+static char checkpoint_file[PATH_MAX];
+static FILE * checkpoint_fp;
+
+/* replay of a previous run */
+static int replaying;
+static struct hash_table * done_files;
+static int num_done;
+static int skipping;
+
+/* nothing but blank lines read since the last file boundary */
+static int at_section_start = 1;
+
+/* the section currently being read from the log */
+static char * section;
+static int section_len;
+static int section_max;
+
+static int pending;
+static time_t last_sync;
+
+static int is_section_header(const char *, int *);
+static void append_section(const char *);
+static void sync_checkpoint();
+
+/*
+ * Open the checkpoint for a log query described by 'query'.  If a
+ * checkpoint of an interrupted run of the same query exists, returns 1
+ * and sets *start_time to the time that run started; the saved sections
+ * should then be read with checkpoint_gets() before the live log.
+ * Returns 0 if ingestion starts from scratch.
+ */
+int checkpoint_open(const char * query, time_t * start_time)
+{
+    char root[PATH_MAX];
+    char repository[PATH_MAX];
+    char buff[BUFSIZ];
+    long complete = 0;
+    FILE * fp;
+
+    strcpy(root, root_path);
+    strcpy(repository, repository_path);
+
+    strrep(root, '/', '#');
+    strrep(repository, '/', '#');
+
+    snprintf(checkpoint_file, PATH_MAX, "%s/%s#%s.checkpoint", get_cvsps_dir(), root, repository);
+
+    done_files = create_hash_table(1023);
+
+    if ((fp = fopen(checkpoint_file, "r+")))
+    {
+	int version = 0;
+	long long start = 0;
+	int valid = 0;
+
+	if (fgets(buff, BUFSIZ, fp) && sscanf(buff, "cvsps checkpoint %d %lld", &version, &start) == 2 &&
+	    version == CHECKPOINT_VERSION && fgets(buff, BUFSIZ, fp))
+	{
+	    chop(buff);
+	    valid = (strcmp(buff, query) == 0);
+	}
+
+	if (valid)
+	{
+	    char * file = NULL;
+	    int at_start = 1;
+
+	    /*
+	     * a crash can leave a partly written section at the end,
+	     * keep only what is followed by a file boundary
+	     */
+	    complete = ftell(fp);
+	    while (fgets(buff, BUFSIZ, fp))
+	    {
+		if (is_section_header(buff, &at_start))
+		{
+		    free(file);
+		    file = xstrdup(buff);
+		}
+		else if (strcmp(buff, CVS_FILE_BOUNDARY) == 0)
+		{
+		    complete = ftell(fp);
+		    at_start = 1;
+
+		    if (file && !get_hash_object(done_files, file))
+		    {
+			put_hash_object(done_files, file, file);
+			num_done++;
+			file = NULL;
+		    }
+		}
+	    }
+
+	    free(file);
+
+	    if (ftruncate(fileno(fp), complete) < 0)
+	    {
+		debug(DEBUG_SYSERROR, "can't truncate checkpoint file %s", checkpoint_file);
+		exit(1);
+	    }
+
+	    rewind(fp);
+	    fgets(buff, BUFSIZ, fp);
+	    fgets(buff, BUFSIZ, fp);
+
+	    debug(DEBUG_APPMSG1, "resuming log ingestion from checkpoint %s", checkpoint_file);
+	    checkpoint_fp = fp;
+	    replaying = 1;
+	    *start_time = (time_t)start;
+	    last_sync = time(NULL);
+	    return 1;
+	}
+
+	debug(DEBUG_APPMSG1, "WARNING: ignoring stale checkpoint file %s", checkpoint_file);
+	fclose(fp);
+    }
+
+    if (!(checkpoint_fp = fopen(checkpoint_file, "w")))
+    {
+	debug(DEBUG_SYSERROR, "can't create checkpoint file %s", checkpoint_file);
+	exit(1);
+    }
+
+    fprintf(checkpoint_fp, "cvsps checkpoint %d %lld\n%s\n", CHECKPOINT_VERSION, (long long)*start_time, query);
+    last_sync = time(NULL);
+    sync_checkpoint();
+    return 0;
+}
+
+/*
+ * Read the next saved line while replaying.  Returns NULL when the
+ * saved sections are exhausted, after which the live log is read.
+ */
+char * checkpoint_gets(char * buff, int len)
+{
+    if (!replaying)
+	return NULL;
+
+    if (fgets(buff, len, checkpoint_fp))
+	return buff;
+
+    debug(DEBUG_APPMSG1, "replayed %d files from checkpoint", num_done);
+
+    /* everything from here on is appended */
+    fseek(checkpoint_fp, 0, SEEK_END);
+    replaying = 0;
+    return NULL;
+}
+
+/*
+ * Was the log of the RCS file 'path' loaded from the checkpoint?
+ */
+int checkpoint_file_done(const char * path)
+{
+    char key[PATH_MAX + 16];
+
+    snprintf(key, sizeof(key), "RCS file: %s\n", path);
+    return (num_done && get_hash_object(done_files, key));
+}
+
+/*
+ * Pass each line of the live log through here before parsing it.
+ * Returns 1 if the line belongs to a section already loaded from the
+ * checkpoint and must be ignored.
+ */
+int checkpoint_filter(const char * buff)
+{
+    if (skipping)
+    {
+	if (strcmp(buff, CVS_FILE_BOUNDARY) == 0)
+	{
+	    skipping = 0;
+	    at_section_start = 1;
+	}
+	return 1;
+    }
+
+    if (is_section_header(buff, &at_section_start) && num_done && get_hash_object(done_files, buff))
+    {
+	debug(DEBUG_STATUS, "skipping checkpointed %s", buff);
+	skipping = 1;
+	section_len = 0;
+	return 1;
+    }
+
+    append_section(buff);
+
+    if (strcmp(buff, CVS_FILE_BOUNDARY) == 0)
+    {
+	if (fwrite(section, 1, section_len, checkpoint_fp) != (size_t)section_len)
+	{
+	    debug(DEBUG_SYSERROR, "can't write checkpoint file %s", checkpoint_file);
+	    exit(1);
+	}
+
+	section_len = 0;
+	at_section_start = 1;
+
+	if (++pending >= CHECKPOINT_SECTIONS || time(NULL) - last_sync >= CHECKPOINT_SECONDS)
+	    sync_checkpoint();
+    }
+
+    return 0;
+}
+
+/*
+ * The log was read completely, the checkpoint is no longer needed
+ */
+void checkpoint_finish()
+{
+    fclose(checkpoint_fp);
+    checkpoint_fp = NULL;
+
+    if (unlink(checkpoint_file) < 0)
+	debug(DEBUG_SYSERROR, "can't remove checkpoint file %s", checkpoint_file);
+
+    destroy_hash_table(done_files, free);
+    done_files = NULL;
+    free(section);
+    section = NULL;
+    section_max = section_len = 0;
+    at_section_start = 1;
+}
+
+/*
+ * Is 'buff' the 'RCS file' line opening a section?  Only the first line
+ * other than blank ones after a file boundary (or the start of the log)
+ * counts, a log message line can start with 'RCS file' too.
+ */
+static int is_section_header(const char * buff, int * at_start)
+{
+    if (strcmp(buff, "\n") == 0)
+	return 0;
+
+    if (!*at_start)
+	return 0;
+
+    *at_start = 0;
+    return (strncmp(buff, "RCS file", 8) == 0);
+}
+
+static void append_section(const char * buff)
+{
+    int len = strlen(buff);
+
+    if (section_len + len > section_max)
+    {
+	section_max = (section_len + len) * 2;
+	if (!(section = (char *)realloc(section, section_max)))
+	{
+	    debug(DEBUG_SYSERROR, "malloc failed for checkpoint section");
+	    exit(1);
+	}
+    }
+
+    memcpy(section + section_len, buff, len);
+    section_len += len;
+}
+
+static void sync_checkpoint()
+{
+    if (fflush(checkpoint_fp) != 0 || fsync(fileno(checkpoint_fp)) < 0)
+    {
+	debug(DEBUG_SYSERROR, "can't sync checkpoint file %s", checkpoint_file);
+	exit(1);
+    }
+
+    pending = 0;
+    last_sync = time(NULL);
+}
@@ -0,0 +1,15 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+int checkpoint_open(const char * query, time_t * start_time);
+char * checkpoint_gets(char * buff, int len);
+int checkpoint_file_done(const char * path);
+int checkpoint_filter(const char * buff);
+void checkpoint_finish();
+
+#endif /* CHECKPOINT_H */
@@ -8,6 +8,9 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 #include <zlib.h>
 #include <sys/socket.h>
 #include <cbtcommon/debug.h>
@@ -39,13 +42,67 @@ struct _CvsServerCtx
 
     /* when reading compressed data, the compressed data buffer */
     char zread_buff[RD_BUFF_SIZE];
+
+    /* the request in progress, for the latency statistics */
+    int req_type;
+    int req_answered;
+    long long req_start;
 };
 
+/*
+ * Protocol statistics, collected for all connections of the process
+ * and written by cvs_direct_stats_dump.  Latencies are kept as log2
+ * histograms of microseconds, bucket n counting [2^n, 2^(n+1)).
+ */
+enum { REQ_RLOG, REQ_RDIFF, REQ_DIFF, REQ_CO, REQ_VERSION, NUM_REQ_TYPES };
+
+static const char * req_names[NUM_REQ_TYPES] = { "rlog", "rdiff", "diff", "co", "version" };
+
+#define LATENCY_BUCKETS 32
+
+struct req_stats
+{
+    long long count;
+    long long total_usec;
+    long long first_byte_usec;
+    long long max_usec;
+    long long hist[LATENCY_BUCKETS];
+};
+
+static struct
+{
+    long long wire_in;
+    long long wire_out;
+    long long payload_in;
+    long long payload_out;
+    long long inflate_usec;
+    long long deflate_usec;
+    long long read_blocked_usec;
+    long long reads;
+    long long refills;
+    struct req_stats req[NUM_REQ_TYPES];
+} stats;
+
+static const char * stats_file;
+static pid_t stats_pid;
+static volatile sig_atomic_t stats_requested;
+
 static void get_cvspass(char *, const char *);
 static void send_string(CvsServerCtx *, const char *, ...);
 static int read_response(CvsServerCtx *, const char *);
-static void ctx_to_fp(CvsServerCtx * ctx, FILE * fp);
+static int ctx_to_fp(CvsServerCtx * ctx, FILE * fp, int * mode);
+static int parse_mode(const char *);
 static int read_line(CvsServerCtx * ctx, char * p);
+static int read_bytes(CvsServerCtx * ctx, char * p, int len);
+static int ctx_to_fp_sized(CvsServerCtx * ctx, FILE * fp, const char * len_str);
+static int ctx_write(CvsServerCtx * ctx, const char * buff, int len);
+
+static long long usec_now(clockid_t);
+static int timed_read(CvsServerCtx *, char *, int);
+static void req_begin(CvsServerCtx *, int);
+static void req_first_byte(CvsServerCtx *);
+static void req_end(CvsServerCtx *);
+static void stats_write_file();
 
 static CvsServerCtx * open_ctx_pserver(CvsServerCtx *, const char *);
 static CvsServerCtx * open_ctx_forked(CvsServerCtx *, const char *);
@@ -63,6 +120,7 @@ CvsServerCtx * open_cvs_server(char * p_root, int compress)
     ctx->read_fd = ctx->write_fd = -1;
     ctx->compressed = 0;
     ctx->is_pserver = 0;
+    ctx->req_type = -1;
 
     if (compress)
     {
@@ -125,8 +183,8 @@ CvsServerCtx * open_cvs_server(char * p_root, int compress)
 
 	send_string(ctx, "Root %s\n", ctx->root);
 
-	/* this is taken from 1.11.1p1 trace - but with Mbinary removed. we can't handle it (yet!) */
-	send_string(ctx, "Valid-responses ok error Valid-requests Checked-in New-entry Checksum Copy-file Updated Created Update-existing Merged Patched Rcs-diff Mode Mod-time Removed Remove-entry Set-static-directory Clear-static-directory Set-sticky Clear-sticky Template Set-checkin-prog Set-update-prog Notified Module-expansion Wrapper-rcsOption M E F\n", ctx->root);
+	/* this is taken from 1.11.1p1 trace */
+	send_string(ctx, "Valid-responses ok error Valid-requests Checked-in New-entry Checksum Copy-file Updated Created Update-existing Merged Patched Rcs-diff Mode Mod-time Removed Remove-entry Set-static-directory Clear-static-directory Set-sticky Clear-sticky Template Set-checkin-prog Set-update-prog Notified Module-expansion Wrapper-rcsOption M Mbinary E F\n", ctx->root);
 
 	send_string(ctx, "valid-requests\n");
 
@@ -342,6 +400,13 @@ static CvsServerCtx * open_ctx_forked(CvsServerCtx * ctx, const char * p_root)
     ctx->read_fd = from_cvs[0];
     ctx->write_fd = to_cvs[1];
 
+    /* 
+     * with several connections open, servers forked later mustn't 
+     * inherit our end of this one, or it never sees EOF
+     */
+    fcntl(ctx->read_fd, F_SETFD, FD_CLOEXEC);
+    fcntl(ctx->write_fd, F_SETFD, FD_CLOEXEC);
+
     strcpy(ctx->root, rep);
 
     return ctx;
@@ -553,6 +618,7 @@ static void send_string(CvsServerCtx * ctx, const char * str, ...)
     if (ctx->compressed)
     {
 	char zbuff[BUFSIZ];
+	long long cpu;
 
 	if  (ctx->zout.avail_in != 0)
 	{
@@ -564,6 +630,8 @@ static void send_string(CvsServerCtx * ctx, const char * str, ...)
 	ctx->zout.avail_in = len;
 	ctx->zout.avail_out = 0;
 
+	stats.payload_out += len;
+
 	while (ctx->zout.avail_in > 0 || ctx->zout.avail_out == 0)
 	{
 	    int ret;
@@ -572,13 +640,15 @@ static void send_string(CvsServerCtx * ctx, const char * str, ...)
 	    ctx->zout.avail_out = BUFSIZ;
 	    
 	    /* FIXME: for the arguments before a command, flushing is counterproductive */
+	    cpu = usec_now(CLOCK_THREAD_CPUTIME_ID);
 	    ret = deflate(&ctx->zout, Z_SYNC_FLUSH);
+	    stats.deflate_usec += usec_now(CLOCK_THREAD_CPUTIME_ID) - cpu;
 	    
 	    if (ret == Z_OK)
 	    {
 		len = BUFSIZ - ctx->zout.avail_out;
 		
-		if (writen(ctx->write_fd, zbuff, len) != len)
+		if (ctx_write(ctx, zbuff, len) != len)
 		{
 		    debug(DEBUG_SYSERROR, "cvs_direct: zout: can't write");
 		    exit(1);
@@ -592,7 +662,9 @@ static void send_string(CvsServerCtx * ctx, const char * str, ...)
     }
     else
     {
-	if (writen(ctx->write_fd, buff, len)  != len)
+	stats.payload_out += len;
+
+	if (ctx_write(ctx, buff, len)  != len)
 	{
 	    debug(DEBUG_SYSERROR, "cvs_direct: can't send command");
 	    exit(1);
@@ -602,6 +674,19 @@ static void send_string(CvsServerCtx * ctx, const char * str, ...)
     debug(DEBUG_TCP, "string: '%s' sent", buff);
 }
 
+/*
+ * Write to the server, counting the bytes sent
+ */
+static int ctx_write(CvsServerCtx * ctx, const char * buff, int len)
+{
+    int ret;
+
+    if ((ret = writen(ctx->write_fd, buff, len)) > 0)
+	stats.wire_out += ret;
+
+    return ret;
+}
+
 static int refill_buffer(CvsServerCtx * ctx)
 {
     int len;
@@ -612,12 +697,17 @@ static int refill_buffer(CvsServerCtx * ctx)
 	exit(1);
     }
 
+    if (stats_requested)
+	stats_write_file();
+
+    stats.refills++;
     ctx->head = ctx->read_buff;
     len = RD_BUFF_SIZE;
 	
     if (ctx->compressed)
     {
 	int zlen, ret;
+	long long cpu;
 
 	/* if there was leftover buffer room, it's time to slurp more data */
 	do 
@@ -629,7 +719,7 @@ static int refill_buffer(CvsServerCtx * ctx)
 		    debug(DEBUG_APPERROR, "cvs_direct: zin: expect 0 avail_in");
 		    exit(1);
 		}
-		zlen = read(ctx->read_fd, ctx->zread_buff, RD_BUFF_SIZE);
+		zlen = timed_read(ctx, ctx->zread_buff, RD_BUFF_SIZE);
 		ctx->zin.next_in = ctx->zread_buff;
 		ctx->zin.avail_in = zlen;
 	    }
@@ -638,13 +728,16 @@ static int refill_buffer(CvsServerCtx * ctx)
 	    ctx->zin.avail_out = len;
 	    
 	    /* FIXME: we don't always need Z_SYNC_FLUSH, do we? */
+	    cpu = usec_now(CLOCK_THREAD_CPUTIME_ID);
 	    ret = inflate(&ctx->zin, Z_SYNC_FLUSH);
+	    stats.inflate_usec += usec_now(CLOCK_THREAD_CPUTIME_ID) - cpu;
 	}
 	while (ctx->zin.avail_out == len);
 
 	if (ret == Z_OK)
 	{
 	    ctx->tail = ctx->head + (len - ctx->zin.avail_out);
+	    stats.payload_in += ctx->tail - ctx->head;
 	}
 	else
 	{
@@ -654,8 +747,9 @@ static int refill_buffer(CvsServerCtx * ctx)
     }
     else
     {
-	len = read(ctx->read_fd, ctx->head, len);
+	len = timed_read(ctx, ctx->head, len);
 	ctx->tail = (len <= 0) ? ctx->head : ctx->head + len;
+	stats.payload_in += ctx->tail - ctx->head;
     }
 
     return len;
@@ -684,6 +778,57 @@ static int read_line(CvsServerCtx * ctx, char * p)
     return len;
 }
 
+/*
+ * Read exactly 'len' bytes, first from whatever is buffered, then
+ * straight from the descriptor into the caller's buffer (unless
+ * compressed, where everything has to pass through the inflate buffer).
+ * File contents are sent with a length prefix and may be binary, so
+ * they must not go through read_line.
+ */
+static int read_bytes(CvsServerCtx * ctx, char * p, int len)
+{
+    int want = len;
+
+    while (want > 0)
+    {
+	int n;
+
+	if (ctx->head != ctx->tail)
+	{
+	    n = ctx->tail - ctx->head;
+	    if (n > want)
+		n = want;
+
+	    memcpy(p, ctx->head, n);
+	    ctx->head += n;
+	}
+	else if (ctx->compressed)
+	{
+	    if (refill_buffer(ctx) <= 0)
+		return -1;
+	    continue;
+	}
+	else
+	{
+	    long long start = usec_now(CLOCK_MONOTONIC);
+
+	    if ((n = readn(ctx->read_fd, p, want)) <= 0)
+		return -1;
+
+	    stats.read_blocked_usec += usec_now(CLOCK_MONOTONIC) - start;
+	    stats.reads++;
+	    stats.wire_in += n;
+	    stats.payload_in += n;
+	    req_first_byte(ctx);
+	}
+
+	p += n;
+	want -= n;
+    }
+
+    return len;
+}
+
 static int read_response(CvsServerCtx * ctx, const char * str)
 {
     /* FIXME: more than 1 char at a time */
@@ -697,31 +842,124 @@ static int read_response(CvsServerCtx * ctx, const char * str)
     return (strcmp(resp, str) == 0);
 }
 
-static void ctx_to_fp(CvsServerCtx * ctx, FILE * fp)
+/*
+ * Copy the response to a request to fp.  Normally the output is in 'M'
+ * lines, but if 'mode' is given the request is a checkout, the file
+ * comes in a Created or Updated response, and 'M' lines are only
+ * messages.  *mode is then set to the permissions the server gave the
+ * file.
+ */
+static int ctx_to_fp(CvsServerCtx * ctx, FILE * fp, int * mode)
 {
     char line[BUFSIZ];
+    int ret = 0;
 
     while (1)
     {
-	read_line(ctx, line);
+	if (read_line(ctx, line) < 0)
+	{
+	    ret = -1;
+	    break;
+	}
 	debug(DEBUG_TCP, "ctx_to_fp: %s", line);
 	if (memcmp(line, "M ", 2) == 0)
 	{
-	    if (fp)
+	    if (fp && !mode)
 		fprintf(fp, "%s\n", line + 2);
 	}
 	else if (memcmp(line, "E ", 2) == 0)
 	{
 	    debug(DEBUG_APPMSG1, "%s", line + 2);
 	}
-	else if (strncmp(line, "ok", 2) == 0 || strncmp(line, "error", 5) == 0)
+	else if (strcmp(line, "Mbinary") == 0)
+	{
+	    /* 'Mbinary' is followed by a line with the length, then the data */
+	    if (read_line(ctx, line) < 0 || ctx_to_fp_sized(ctx, fp, line) < 0)
+	    {
+		ret = -1;
+		break;
+	    }
+	}
+	else if (strncmp(line, "Created ", 8) == 0 || strncmp(line, "Updated ", 8) == 0 ||
+		 strncmp(line, "Update-existing ", 16) == 0 || strncmp(line, "Merged ", 7) == 0)
+	{
+	    int i;
+
+	    /* 
+	     * the pathname is followed by the repository path, the 
+	     * entries line, the mode and the length of the contents
+	     */
+	    for (i = 0; i < 4; i++)
+	    {
+		if (read_line(ctx, line) < 0)
+		    break;
+		if (i == 2 && mode)
+		    *mode = parse_mode(line);
+	    }
+
+	    if (i < 4 || ctx_to_fp_sized(ctx, fp, line) < 0)
+	    {
+		ret = -1;
+		break;
+	    }
+	}
+	else if (strncmp(line, "ok", 2) == 0)
 	{
 	    break;
 	}
+	else if (strncmp(line, "error", 5) == 0)
+	{
+	    ret = -1;
+	    break;
+	}
     }
 
     if (fp)
 	fflush(fp);
+
+    req_end(ctx);
+    return ret;
+}
+
+/*
+ * Copy length prefixed file contents to fp.  The length comes from the
+ * line preceding the data.  A leading 'z' would mean gzip-file-contents,
+ * which we never request.
+ */
+static int ctx_to_fp_sized(CvsServerCtx * ctx, FILE * fp, const char * len_str)
+{
+    char buff[RD_BUFF_SIZE * 16];
+    char * end;
+    long len = strtol(len_str, &end, 10);
+
+    if (end == len_str || *end || len < 0)
+    {
+	debug(DEBUG_APPERROR, "cvs_direct: bad file length '%s'", len_str);
+	return -1;
+    }
+
+    debug(DEBUG_TCP, "ctx_to_fp_sized: %ld bytes", len);
+
+    while (len > 0)
+    {
+	int n = (len > sizeof(buff)) ? sizeof(buff) : len;
+
+	if (read_bytes(ctx, buff, n) < 0)
+	{
+	    debug(DEBUG_APPERROR, "cvs_direct: short read of file contents");
+	    return -1;
+	}
+
+	if (fp && fwrite(buff, 1, n, fp) != n)
+	{
+	    debug(DEBUG_SYSERROR, "cvs_direct: can't write file contents");
+	    return -1;
+	}
+
+	len -= n;
+    }
+
+    return 0;
 }
 
 void cvs_rdiff(CvsServerCtx * ctx, 
@@ -730,6 +968,7 @@ void cvs_rdiff(CvsServerCtx * ctx,
 {
     /* NOTE: opts are ignored for rdiff, '-u' is always used */
 
+    req_begin(ctx, REQ_RDIFF);
     send_string(ctx, "Argument -u\n");
     send_string(ctx, "Argument -r\n");
     send_string(ctx, "Argument %s\n", rev1);
@@ -738,7 +977,7 @@ void cvs_rdiff(CvsServerCtx * ctx,
     send_string(ctx, "Argument %s%s\n", rep, file);
     send_string(ctx, "rdiff\n");
 
-    ctx_to_fp(ctx, stdout);
+    ctx_to_fp(ctx, stdout, NULL);
 }
 
 void cvs_rupdate(CvsServerCtx * ctx, const char * rep, const char * file, const char * rev, int create, const char * opts)
@@ -757,15 +996,69 @@ void cvs_rupdate(CvsServerCtx * ctx, const char * rep, const char * file, const
 	exit(1);
     }
 
-    send_string(ctx, "Argument -p\n");
+    cvs_co(ctx, rep, file, rev, fp, NULL);
+
+    pclose(fp);
+}
+
+/*
+ * Check out file:rev to fp.  This is a real checkout rather than 'co -p'
+ * so that the server also says what mode the file has (it follows the
+ * executable bit of the RCS file), which is returned in *mode if given.
+ */
+int cvs_co(CvsServerCtx * ctx, const char * rep, const char * file, const char * rev, FILE * fp, int * mode)
+{
+    int dummy;
+
+    if (!mode)
+	mode = &dummy;
+
+    *mode = 0644;
+
+    req_begin(ctx, REQ_CO);
+    send_string(ctx, "Argument -N\n");
     send_string(ctx, "Argument -r\n");
     send_string(ctx, "Argument %s\n", rev);
+    send_string(ctx, "Argument --\n");
     send_string(ctx, "Argument %s/%s\n", rep, file);
+    send_string(ctx, "Directory .\n");
+    send_string(ctx, "%s\n", ctx->root);
     send_string(ctx, "co\n");
 
-    ctx_to_fp(ctx, fp);
+    return ctx_to_fp(ctx, fp, mode);
+}
 
-    pclose(fp);
+/*
+ * Convert a mode as sent by the server, e.g. 'u=rwx,g=rx,o=rx', to
+ * permission bits
+ */
+static int parse_mode(const char * str)
+{
+    int mode = 0, who = 0, perm = 0;
+    const char * p;
+
+    for (p = str;; p++)
+    {
+	switch (*p)
+	{
+	case 'u': who |= 0700; break;
+	case 'g': who |= 0070; break;
+	case 'o': who |= 0007; break;
+	case 'r': perm |= 0444; break;
+	case 'w': perm |= 0222; break;
+	case 'x': perm |= 0111; break;
+	case ',':
+	case 0:
+	    mode |= who & perm;
+	    who = perm = 0;
+	    break;
+	}
+
+	if (!*p)
+	    break;
+    }
+
+    return mode;
 }
 
 static int parse_patch_arg(char * arg, char ** str)
@@ -811,6 +1104,7 @@ void cvs_diff(CvsServerCtx * ctx,
     char arg[32];
     char file_buff[PATH_MAX], *basename;
 
+    req_begin(ctx, REQ_DIFF);
     strzncpy(argstr, opts, BUFSIZ);
     while (parse_patch_arg(arg, &p))
 	send_string(ctx, "Argument %s\n", arg);
@@ -842,10 +1136,13 @@ void cvs_diff(CvsServerCtx * ctx,
     send_string(ctx, "Argument %s/%s\n", rep, file);
     send_string(ctx, "diff\n");
 
-    ctx_to_fp(ctx, stdout);
+    ctx_to_fp(ctx, stdout, NULL);
 }
 
 /*
+ * Start an rlog of 'paths' with the options in 'opts' (space separated,
+ * may be empty).  The output is read with cvs_rlog_fgets()
+ *
  * FIXME: the design of this sucks.  It was originally designed to fork a subprocess
  * which read the cvs response and send it back through a pipe the main process,
  * which fdopen(3)ed the other end, and juts used regular fgets.  This however
@@ -853,18 +1150,30 @@ void cvs_diff(CvsServerCtx * ctx,
  * the compression state, and there was no way to resynchronize that state with
  * the parent process.  We could use threads...
  */
-FILE * cvs_rlog_open(CvsServerCtx * ctx, const char * rep, const char * date_str)
+FILE * cvs_rlog_open(CvsServerCtx * ctx, const char * opts, const char * date_str, char ** paths, int num_paths)
 {
+    char argstr[BUFSIZ], *p = argstr;
+    char arg[32];
+    int i;
+
+    req_begin(ctx, REQ_RLOG);
+
+    strzncpy(argstr, opts, BUFSIZ);
+    while (*opts && parse_patch_arg(arg, &p))
+	send_string(ctx, "Argument %s\n", arg);
+
     /* note: use of the date_str is handled in a non-standard, cvsps specific way */
     if (date_str && date_str[0])
     {
-	send_string(ctx, "Argument -d\n", rep);
+	send_string(ctx, "Argument -d\n");
 	send_string(ctx, "Argument %s<1 Jan 2038 05:00:00 -0000\n", date_str);
-	send_string(ctx, "Argument -d\n", rep);
+	send_string(ctx, "Argument -d\n");
 	send_string(ctx, "Argument %s\n", date_str);
     }
 
-    send_string(ctx, "Argument %s\n", rep);
+    for (i = 0; i < num_paths; i++)
+	send_string(ctx, "Argument %s\n", paths[i]);
+
     send_string(ctx, "rlog\n");
 
     /*
@@ -895,6 +1204,7 @@ char * cvs_rlog_fgets(char * buff, int buflen, CvsServerCtx * ctx)
     else if (strcmp(lbuff, "ok") == 0 ||strcmp(lbuff, "error") == 0)
     {
 	debug(DEBUG_TCP, "cvs_direct: rlog: got command completion");
+	req_end(ctx);
 	return NULL;
     }
 
@@ -909,6 +1219,7 @@ void cvs_version(CvsServerCtx * ctx, char * client_version, char * server_versio
 {
     char lbuff[BUFSIZ];
     strcpy(client_version, "Client: Concurrent Versions System (CVS) 99.99.99 (client/server) cvs-direct");
+    req_begin(ctx, REQ_VERSION);
     send_string(ctx, "version\n");
     read_line(ctx, lbuff);
     if (memcmp(lbuff, "M ", 2) == 0)
@@ -920,6 +1231,204 @@ void cvs_version(CvsServerCtx * ctx, char * client_version, char * server_versio
     if (strcmp(lbuff, "ok") != 0)
 	debug(DEBUG_APPERROR, "cvs_direct: protocol error reading version");
 
+    req_end(ctx);
+
     debug(DEBUG_TCP, "cvs_direct: client version %s", client_version);
     debug(DEBUG_TCP, "cvs_direct: server version %s", server_version);
 }
+
+/* 
+ * The clock is only read when statistics are being collected, so
+ * without --cvs-stats the timing around each read, deflate and inflate
+ * costs no system calls
+ */
+static long long usec_now(clockid_t clock)
+{
+    struct timespec ts;
+
+    if (!stats_file)
+	return 0;
+
+    clock_gettime(clock, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* read(2) on the server connection, counting the time spent blocked */
+static int timed_read(CvsServerCtx * ctx, char * buff, int len)
+{
+    long long start = usec_now(CLOCK_MONOTONIC);
+    int ret = read(ctx->read_fd, buff, len);
+
+    stats.read_blocked_usec += usec_now(CLOCK_MONOTONIC) - start;
+    stats.reads++;
+
+    if (ret > 0)
+    {
+	stats.wire_in += ret;
+	req_first_byte(ctx);
+    }
+
+    return ret;
+}
+
+/*
+ * Requests made through the blocking calls are timed from the first
+ * byte sent to the 'ok' or 'error' that completes them.
+ */
+static void req_begin(CvsServerCtx * ctx, int type)
+{
+    if (stats_requested)
+	stats_write_file();
+
+    ctx->req_type = type;
+    ctx->req_answered = 0;
+    ctx->req_start = usec_now(CLOCK_MONOTONIC);
+}
+
+static void req_first_byte(CvsServerCtx * ctx)
+{
+    if (ctx->req_type < 0 || ctx->req_answered)
+	return;
+
+    ctx->req_answered = 1;
+    stats.req[ctx->req_type].first_byte_usec += usec_now(CLOCK_MONOTONIC) - ctx->req_start;
+}
+
+static void req_end(CvsServerCtx * ctx)
+{
+    struct req_stats * rs;
+    long long usec;
+    int bucket = 0;
+
+    if (ctx->req_type < 0)
+	return;
+
+    rs = &stats.req[ctx->req_type];
+    usec = usec_now(CLOCK_MONOTONIC) - ctx->req_start;
+
+    while (bucket < LATENCY_BUCKETS - 1 && (usec >> (bucket + 1)) > 0)
+	bucket++;
+
+    rs->count++;
+    rs->total_usec += usec;
+    rs->hist[bucket]++;
+    if (usec > rs->max_usec)
+	rs->max_usec = usec;
+
+    ctx->req_type = -1;
+}
+
+void cvs_direct_stats_dump(FILE * fp)
+{
+    int i, j, last;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"wire_bytes_in\": %lld,\n", stats.wire_in);
+    fprintf(fp, "  \"wire_bytes_out\": %lld,\n", stats.wire_out);
+    fprintf(fp, "  \"payload_bytes_in\": %lld,\n", stats.payload_in);
+    fprintf(fp, "  \"payload_bytes_out\": %lld,\n", stats.payload_out);
+    fprintf(fp, "  \"inflate_cpu_usec\": %lld,\n", stats.inflate_usec);
+    fprintf(fp, "  \"deflate_cpu_usec\": %lld,\n", stats.deflate_usec);
+    fprintf(fp, "  \"read_blocked_usec\": %lld,\n", stats.read_blocked_usec);
+    fprintf(fp, "  \"reads\": %lld,\n", stats.reads);
+    fprintf(fp, "  \"refills\": %lld,\n", stats.refills);
+    fprintf(fp, "  \"requests\": {\n");
+
+    for (i = 0; i < NUM_REQ_TYPES; i++)
+    {
+	struct req_stats * rs = &stats.req[i];
+
+	for (last = LATENCY_BUCKETS - 1; last > 0 && !rs->hist[last]; last--)
+	    ;
+
+	fprintf(fp, "    \"%s\": { \"count\": %lld, \"total_usec\": %lld, \"first_byte_usec\": %lld, \"max_usec\": %lld,\n",
+		req_names[i], rs->count, rs->total_usec, rs->first_byte_usec, rs->max_usec);
+	fprintf(fp, "      \"latency_log2_usec\": [");
+	for (j = 0; j <= last; j++)
+	    fprintf(fp, "%s%lld", j ? ", " : "", rs->hist[j]);
+	fprintf(fp, "] }%s\n", (i < NUM_REQ_TYPES - 1) ? "," : "");
+    }
+
+    fprintf(fp, "  }\n");
+    fprintf(fp, "}\n");
+}
+
+/* 
+ * Write a snapshot of the statistics, replacing the file atomically so
+ * a reader never sees a partial report
+ */
+static void stats_write_file()
+{
+    char tmp[PATH_MAX];
+    FILE * fp;
+
+    stats_requested = 0;
+
+    if (strcmp(stats_file, "-") == 0)
+    {
+	cvs_direct_stats_dump(stderr);
+	return;
+    }
+
+    snprintf(tmp, PATH_MAX, "%s.tmp", stats_file);
+    if (!(fp = fopen(tmp, "w")))
+    {
+	debug(DEBUG_SYSERROR, "cvs_direct: can't write statistics to %s", tmp);
+	return;
+    }
+
+    cvs_direct_stats_dump(fp);
+
+    if (fclose(fp) != 0 || rename(tmp, stats_file) < 0)
+    {
+	debug(DEBUG_SYSERROR, "cvs_direct: can't write statistics to %s", stats_file);
+	unlink(tmp);
+    }
+}
+
+static void stats_at_exit()
+{
+    /* not from forked children, e.g. the diff prewarmer */
+    if (getpid() == stats_pid)
+	stats_write_file();
+}
+
+/*
+ * The handler only sets a flag.  The report is written the next time
+ * the protocol code refills its buffer or starts a request, or when the
+ * main program polls with cvs_direct_stats_poll() between its phases,
+ * so the dump can lag the signal by as long as one blocking read.
+ */
+static void stats_signal(int sig)
+{
+    stats_requested = 1;
+}
+
+/*
+ * Write a report requested with SIGUSR1 now, for the stretches where
+ * no requests are made, e.g. while building the patch sets
+ */
+void cvs_direct_stats_poll()
+{
+    if (stats_requested)
+	stats_write_file();
+}
+
+/*
+ * Write the statistics to 'file' ("-" for stderr) when the process
+ * exits, and whenever it receives SIGUSR1
+ */
+void cvs_direct_stats_init(const char * file)
+{
+    struct sigaction sa;
+
+    stats_file = file;
+    stats_pid = getpid();
+    atexit(stats_at_exit);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stats_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+}
@@ -15,10 +15,15 @@ CvsServerCtx * open_cvs_server(char * root, int);
 void close_cvs_server(CvsServerCtx*);
 void cvs_rdiff(CvsServerCtx *, const char *, const char *, const char *, const char *);
 void cvs_rupdate(CvsServerCtx *, const char *, const char *, const char *, int, const char *);
+int cvs_co(CvsServerCtx *, const char *, const char *, const char *, FILE *, int *);
 void cvs_diff(CvsServerCtx *, const char *, const char *, const char *, const char *, const char *);
-FILE * cvs_rlog_open(CvsServerCtx *, const char *, const char *);
+FILE * cvs_rlog_open(CvsServerCtx *, const char *, const char *, char **, int);
 char * cvs_rlog_fgets(char *, int, CvsServerCtx *);
 void cvs_rlog_close(CvsServerCtx *);
 void cvs_version(CvsServerCtx *, char *, char *);
 
+void cvs_direct_stats_init(const char *);
+void cvs_direct_stats_dump(FILE *);
+void cvs_direct_stats_poll();
+
 #endif /* CVS_DIRECT_H */
@@ -31,6 +31,14 @@
 #include "cap.h"
 #include "cvs_direct.h"
 #include "list_sort.h"
+#include "revcache.h"
+#include "diffcache.h"
+#include "checkpoint.h"
+#include "profile.h"
+#include "trace.h"
+#include "fast_import.h"
+#include "ndjson.h"
+#include "workpool.h"
 
 RCSID("$Id: cvsps.c,v 4.106 2005/05/26 03:39:29 david Exp $");
 
@@ -119,11 +127,93 @@ static int cvs_direct;
 static int compress;
 static char compress_arg[8];
 static int track_branch_ancestry;
+static int rev_cache;
+static int rev_cache_size = 512;
+static int diff_cache;
+static int prewarm_ps_min;
+static int prewarm_ps_max;
+static int checkpoint;
+static const char * cvs_stats_file;
+static const char * profile_file;
+static int fast_import;
+static int ndjson;
+static int num_threads;
+
+/* longest label of a cached diff: <repository>/<file>:<rev> */
+#define LABEL_MAX (PATH_MAX * 2 + REV_STR_MAX)
+
+/* longest command line used for a batched diff */
+#define BATCH_CMD_MAX 65536
+
+/* longest revision arguments of a batched diff */
+#define BATCH_ARGS_MAX 160
+
+/*
+ * How diffs are generated, which depends on the options in effect.
+ * Filled in by get_diff_type()
+ */
+typedef struct _DiffType
+{
+    const char * dtype;
+    const char * dopts;
+    const char * utype;
+    char use_rep_path[PATH_MAX];
+    char esc_use_rep_path[PATH_MAX * 2];
+} DiffType;
+
+/*
+ * The diff of a member which was diffed in a batch with others, see
+ * do_batched_diff().  'output' is set in the first member of a batch,
+ * and holds the text of all of them.
+ */
+typedef struct _BatchedDiff
+{
+    int done;
+    int failed;
+    const char * text;
+    int len;
+    char * output;
+} BatchedDiff;
+
+/*
+ * A change to make when resolving a global symbol, found by
+ * resolve_symbol() and made by apply_symbol()
+ */
+enum
+{
+    SC_NOT_PRESENT,	/* the revision of 'tag' is not present */
+    SC_FUNK_STEP,	/* check_tag_funk() got to 'rev', in 'ps' */
+    SC_FUNK_HIT,	/* and member 'psm' of 'ps' is before the tag */
+    SC_VIOLATION	/* 'tag' on 'rev' gets 'flag' */
+};
+
+typedef struct _SymbolChange
+{
+    int type;
+    int flag;
+    Tag * tag;
+    CvsFileRevision * rev;
+    PatchSet * ps;
+    PatchSetMember * psm;
+} SymbolChange;
+
+typedef struct _SymbolResolution
+{
+    GlobalSymbol * sym;
+    PatchSet * ps;
+    SymbolChange * changes;
+    int num_changes;
+    int max_changes;
+} SymbolResolution;
 
 static void check_norc(int, char *[]);
 static int parse_args(int, char *[]);
 static int parse_rc();
 static void load_from_cvs();
+static FILE * open_cvs_log(const char *, const char *, const char *, char **, int);
+static char * read_cvs_log(char *, int, FILE *);
+static void close_cvs_log(FILE *);
+static int get_unfinished_paths(const char *, char *, char ***);
 static void init_paths();
 static CvsFile * build_file_by_name(const char *);
 static int get_branch_ext(char *, const char *, int *);
@@ -146,6 +236,21 @@ static int is_revision_metadata(const char *);
 static int patch_set_member_regex(PatchSet * ps, regex_t * reg);
 static int patch_set_affects_branch(PatchSet *, const char *);
 static void do_cvs_diff(PatchSet *);
+static void get_diff_type(DiffType *);
+static void do_member_diff(PatchSetMember *, DiffType *);
+static int lookup_diffcache_entry(PatchSetMember *, DiffType *, char *, char *);
+static void get_diffcache_entry(PatchSetMember *, DiffType *, char *);
+static void prewarm_diff_cache();
+static void prewarm_patch_set(PatchSet *);
+static void open_cvs_direct_lazily();
+static int get_batch_args(PatchSet *, PatchSetMember *, char *);
+static int dates_select_member(PatchSet *, PatchSetMember *);
+static int is_trunk_rev(const char *);
+static int do_batched_diff(PatchSetMember **, BatchedDiff **, int, const char *, DiffType *);
+static int split_batched_diff(char *, PatchSetMember **, BatchedDiff **, int, DiffType *);
+static void do_cached_diff(PatchSetMember *, const char *);
+static void get_cached_revision(char *, CvsFile *, const char *);
+static void fetch_revision(const char *, CvsFile *, const char *);
 static PatchSet * create_patch_set();
 static PatchSetRange * create_patch_set_range();
 static void parse_sym(CvsFile *, char *);
@@ -153,7 +258,10 @@ static void resolve_global_symbols();
 static int revision_affects_symbol(CvsFileRevision *, const char *);
 static int is_vendor_branch(const char *);
 static void set_psm_initial(PatchSetMember * psm);
-static int check_tag_funk(PatchSet *, const char *, CvsFileRevision *);
+static void resolve_symbol(int, void *);
+static int apply_symbol(SymbolResolution *);
+static void add_symbol_change(SymbolResolution *, int, Tag *, CvsFileRevision *, PatchSet *, PatchSetMember *, int);
+static int check_tag_funk(SymbolResolution *, PatchSet *, CvsFileRevision *);
 static CvsFileRevision * rev_follow_branch(CvsFileRevision *, const GlobalSymbol *);
 static void determine_branch_ancestor(PatchSet * ps, PatchSet * head_ps);
 static void handle_collisions();
@@ -162,6 +270,8 @@ int main(int argc, char *argv[])
 {
     debuglvl = DEBUG_APPERROR|DEBUG_SYSERROR|DEBUG_APPMSG1;
 
+    trace_init();
+
     /*
      * we want to parse the rc first, so command line can override it
      * but also, --norc should stop the rc from being processed, so
@@ -196,10 +306,21 @@ int main(int argc, char *argv[])
     global_symbols = create_hash_table(111);
     branch_heads = create_hash_table(1023);
 
+    if (profile_file)
+	profile_init(profile_file);
+
     /* this parses some of the CVS/ files, and initializes
      * the repository_path and other variables 
      */
+    profile_begin("init_paths");
     init_paths();
+    profile_end();
+
+    if (rev_cache && (do_diff || prewarm_ps_min || fast_import))
+	revcache_init(rev_cache_size * 1024L);
+
+    if (diff_cache && (do_diff || prewarm_ps_min))
+	diffcache_init();
 
     if (!ignore_cache)
     {
@@ -212,35 +333,61 @@ int main(int argc, char *argv[])
 
 	timestamp_fuzz_factor = 0;
 
+	profile_begin("read_cache");
 	if ((cache_date = read_cache()) < 0)
 	    update_cache = 1;
+	profile_end();
 
 	timestamp_fuzz_factor = save_fuzz_factor;
     }
 
-    if (cvs_direct && (do_diff || (update_cache && !test_log_file)))
-	cvs_direct_ctx = open_cvs_server(root_path, compress);
+    if (cvs_stats_file)
+	cvs_direct_stats_init(cvs_stats_file);
+
+    /* with the revision or diff cache, the server is only contacted on a cache miss */
+    if (cvs_direct && ((do_diff && !rev_cache && !diff_cache) || (update_cache && !test_log_file)))
+    {
+	/* if the connection fails, fall back to the cvs client */
+	if (!(cvs_direct_ctx = open_cvs_server(root_path, compress)))
+	    cvs_direct = 0;
+    }
 
     if (update_cache)
     {
+	profile_begin("load_from_cvs");
 	load_from_cvs();
+	profile_end();
 	// do_write_cache = 1;
     }
 
     //XXX
     //handle_collisions();
 
+    profile_begin("list_sort");
     list_sort(&all_patch_sets, compare_patch_sets_bytime_list);
+    profile_end();
 
     ps_counter = 0;
+    profile_begin("assign_patchset_id");
     walk_all_patch_sets(assign_patchset_id);
+    profile_end();
 
+    profile_begin("handle_collisions");
     handle_collisions();
+    profile_end();
 
+    profile_begin("resolve_global_symbols");
     resolve_global_symbols();
+    profile_end();
+
+    cvs_direct_stats_poll();
 
     if (do_write_cache)
+    {
+	profile_begin("write_cache");
 	write_cache(cache_date);
+	profile_end();
+    }
 
     if (statistics)
 	print_statistics(ps_tree);
@@ -259,11 +406,31 @@ int main(int argc, char *argv[])
 	exit(1);
     }
 
-    walk_all_patch_sets(check_print_patch_set);
+    if (prewarm_ps_min)
+	prewarm_diff_cache();
 
-    if (summary_first++)
+    profile_begin("print");
+    if (fast_import)
+    {
+	fast_import_begin();
+	walk_all_patch_sets(check_print_patch_set);
+	fast_import_end();
+    }
+    else if (ndjson)
+    {
+	ndjson_begin();
+	walk_all_patch_sets(check_print_patch_set);
+	ndjson_end();
+    }
+    else
+    {
 	walk_all_patch_sets(check_print_patch_set);
 
+	if (summary_first++)
+	    walk_all_patch_sets(check_print_patch_set);
+    }
+    profile_end();
+
     if (cvs_direct_ctx)
 	close_cvs_server(cvs_direct_ctx);
 
@@ -283,10 +450,15 @@ static void load_from_cvs()
     char * logbuff = malloc(logbufflen);
     int loglen = 0;
     int have_log = 0;
-    char cmd[BUFSIZ];
     char date_str[64];
     char use_rep_buff[PATH_MAX];
     char * ltype;
+    char * rep;
+    char ** paths;
+    int num_paths;
+    int log_needed = 1;
+    const char * log_opts = "";
+    int replaying = 0;
 
     if (logbuff == NULL)
     {
@@ -317,46 +489,101 @@ static void load_from_cvs()
 	 * get us all revisions that have occurred since last update
 	 * and overlaps what we had before by exactly one revision,
 	 * which is necessary to fill in the pre_rev stuff for a 
-	 * PatchSetMember
+	 * PatchSetMember (see open_cvs_log)
 	 */
-	snprintf(cmd, BUFSIZ, "cvs %s %s -q %s -d '%s<;%s' %s", compress_arg, norc, ltype, date_str, date_str, use_rep_buff);
     }
     else
     {
 	date_str[0] = 0;
-	snprintf(cmd, BUFSIZ, "cvs %s %s -q %s %s", compress_arg, norc, ltype, use_rep_buff);
     }
-    
-    debug(DEBUG_STATUS, "******* USING CMD %s", cmd);
+
+    /* cvs_direct always uses rlog */
+    rep = cvs_direct_ctx ? repository_path : use_rep_buff;
+    paths = &rep;
+    num_paths = rep[0] ? 1 : 0;
 
     cache_date = time(NULL);
 
+    if (checkpoint)
+    {
+	char query[BUFSIZ];
+
+	/* 
+	 * an interrupted run of the same query is resumed.  the cache
+	 * date is the time that run started, because the files loaded
+	 * from the checkpoint are only up to date as of then
+	 */
+	snprintf(query, BUFSIZ, "%s %s", ltype, date_str);
+	replaying = checkpoint_open(query, &cache_date);
+    }
+
+    /* 
+     * and the log of the files loaded from the checkpoint isn't
+     * downloaded again, as far as the server lets us avoid it
+     */
+    if (replaying && !test_log_file)
+    {
+	char ** unfinished;
+	int n = get_unfinished_paths(ltype, rep, &unfinished);
+
+	if (n >= 0)
+	{
+	    debug(DEBUG_APPMSG1, "resuming the log with %d paths", n);
+	    paths = unfinished;
+	    num_paths = n;
+	    log_needed = (n > 0);
+	    log_opts = "-l";
+	}
+    }
+
     /* FIXME: this is ugly, need to virtualize the accesses away from here */
     if (test_log_file)
-	cvsfp = fopen(test_log_file, "r");
-    else if (cvs_direct_ctx)
-	cvsfp = cvs_rlog_open(cvs_direct_ctx, repository_path, date_str);
+    {
+	if (!(cvsfp = fopen(test_log_file, "r")))
+	{
+	    debug(DEBUG_SYSERROR, "can't open test log file %s", test_log_file);
+	    exit(1);
+	}
+    }
+    else if (log_needed)
+    {
+	cvsfp = open_cvs_log(ltype, log_opts, date_str, paths, num_paths);
+    }
     else
-	cvsfp = popen(cmd, "r");
+    {
+	cvsfp = NULL;
+    }
 
-    if (!cvsfp)
+    if (paths != &rep)
     {
-	debug(DEBUG_SYSERROR, "can't open cvs pipe using command %s", cmd);
-	exit(1);
+	int i;
+
+	for (i = 0; i < num_paths; i++)
+	    free(paths[i]);
+	free(paths);
     }
 
     for (;;)
     {
-	char * tst;
-	if (cvs_direct_ctx)
-	    tst = cvs_rlog_fgets(buff, BUFSIZ, cvs_direct_ctx);
-	else
+	char * tst = NULL;
+
+	if (replaying && !(tst = checkpoint_gets(buff, BUFSIZ)))
+	    replaying = 0;
+
+	if (replaying || !cvsfp)
+	    ;
+	else if (test_log_file)
 	    tst = fgets(buff, BUFSIZ, cvsfp);
+	else
+	    tst = read_cvs_log(buff, BUFSIZ, cvsfp);
 
 	if (!tst)
 	    break;
 
-	debug(DEBUG_STATUS, "state: %d read line:%s", state, buff);
+	if (checkpoint && !replaying && checkpoint_filter(buff))
+	    continue;
+
+	trace(TRACE_PARSE, "state: %d read line:%s", state, buff);
 
 	switch(state)
 	{
@@ -539,7 +766,7 @@ static void load_from_cvs()
 		}
 		else
 		{
-		    debug(DEBUG_STATUS, "ignoring unhandled info %s", buff);
+		    trace(TRACE_PARSE, "ignoring unhandled info %s", buff);
 		}
 	    }
 	    else
@@ -551,7 +778,7 @@ static void load_from_cvs()
 			
 			if (len >= logbufflen - loglen)
 			{
-			    debug(DEBUG_STATUS, "reallocating logbufflen to %d bytes for file %s", logbufflen, file->filename);
+			    trace(TRACE_PARSE, "reallocating logbufflen to %d bytes for file %s", logbufflen, file->filename);
 			    logbufflen += (len >= LOG_STR_MAX ? (len+1) : LOG_STR_MAX);
 			    char * newlogbuff = realloc(logbuff, logbufflen);
 			    if (newlogbuff == NULL)
@@ -562,7 +789,7 @@ static void load_from_cvs()
 			    logbuff = newlogbuff;
 			}
 
-			debug(DEBUG_STATUS, "appending %s to log", buff);
+			trace(TRACE_PARSE, "appending %s to log", buff);
 			memcpy(logbuff + loglen, buff, len);
 			loglen += len;
 			logbuff[loglen] = 0;
@@ -588,16 +815,86 @@ static void load_from_cvs()
     }
     
     if (test_log_file)
-    {
 	fclose(cvsfp);
+    else if (cvsfp)
+	close_cvs_log(cvsfp);
+
+    if (checkpoint)
+	checkpoint_finish();
+}
+
+/*
+ * Start the cvs log of 'paths' (the current directory if there are
+ * none) with the options 'opts'.  If 'date_str' is set, only the
+ * revisions since then, and the one before, are logged.  The log is read
+ * with read_cvs_log() and closed with close_cvs_log().
+ */
+static FILE * open_cvs_log(const char * ltype, const char * opts, const char * date_str, char ** paths, int num_paths)
+{
+    char esc_path[PATH_MAX * 2];
+    char * cmd;
+    int len, max, i;
+    FILE * fp;
+
+    if (cvs_direct_ctx)
+	return cvs_rlog_open(cvs_direct_ctx, opts, date_str, paths, num_paths);
+
+    max = BUFSIZ;
+    for (i = 0; i < num_paths; i++)
+	max += 2 * strlen(paths[i]) + 1;
+
+    if (!(cmd = (char *)malloc(max)))
+    {
+	debug(DEBUG_SYSERROR, "malloc failed for cvs log command");
+	exit(1);
     }
-    else if (cvs_direct_ctx)
+
+    len = snprintf(cmd, max, "cvs %s %s -q %s %s", compress_arg, norc, ltype, opts);
+
+    /* this command asks for logs using two different date
+     * arguments, separated by ';' (see man rlog).  The first
+     * gets all revisions more recent than date, the second 
+     * gets a single revision no later than date
+     */
+    if (date_str[0])
+	len += snprintf(cmd + len, max - len, " -d '%s<;%s'", date_str, date_str);
+
+    for (i = 0; i < num_paths; i++)
+    {
+	/* the paths may contain characters that the shell will barf on */
+	escape_filename(esc_path, sizeof(esc_path), paths[i]);
+	len += snprintf(cmd + len, max - len, " %s", esc_path);
+    }
+
+    debug(DEBUG_STATUS, "******* USING CMD %s", cmd);
+
+    if (!(fp = popen(cmd, "r")))
+    {
+	debug(DEBUG_SYSERROR, "can't open cvs pipe using command %s", cmd);
+	exit(1);
+    }
+
+    free(cmd);
+    return fp;
+}
+
+static char * read_cvs_log(char * buff, int len, FILE * fp)
+{
+    if (cvs_direct_ctx)
+	return cvs_rlog_fgets(buff, len, cvs_direct_ctx);
+
+    return fgets(buff, len, fp);
+}
+
+static void close_cvs_log(FILE * fp)
+{
+    if (cvs_direct_ctx)
     {
 	cvs_rlog_close(cvs_direct_ctx);
     }
     else
     {
-	if (pclose(cvsfp) < 0)
+	if (pclose(fp) < 0)
 	{
 	    debug(DEBUG_APPERROR, "cvs rlog command exited with error. aborting");
 	    exit(1);
@@ -605,6 +902,93 @@ static void load_from_cvs()
     }
 }
 
+/*
+ * When resuming from a checkpoint, the log is only needed for the files
+ * which weren't loaded from it.  The files of the repository are listed
+ * with 'rlog -R', which is cheap, and the directories with any of them
+ * left to load are returned in 'paths' (prefixed with 'rep'), to ask for
+ * the log of without recursion ('rlog -l').  Returns the number of
+ * paths, or -1 if the listing doesn't match up with the checkpoint, in
+ * which case the whole log has to be read.
+ */
+static int get_unfinished_paths(const char * ltype, char * rep, char *** paths)
+{
+    struct hash_table * seen = create_hash_table(1023);
+    char buff[BUFSIZ];
+    char path[PATH_MAX];
+    int num = 0, max = 0, ret = 0;
+    FILE * fp;
+
+    *paths = NULL;
+    fp = open_cvs_log(ltype, "-R", "", &rep, rep[0] ? 1 : 0);
+
+    /* the listing is read to the end in any case */
+    while (read_cvs_log(buff, BUFSIZ, fp))
+    {
+	char * name, * p;
+	int len;
+
+	chop(buff);
+
+	if (ret < 0 || !buff[0] || checkpoint_file_done(buff))
+	    continue;
+
+	/* see parse_rcs_file, the paths might not be the nominal ones */
+	if (strncmp(buff, strip_path, strip_path_len) != 0)
+	{
+	    debug(DEBUG_STATUS, "can't resume the log of %s", buff);
+	    ret = -1;
+	    continue;
+	}
+
+	name = buff + strip_path_len;
+	if ((p = strrchr(name, '/')))
+	    *p = 0;
+	else
+	    name = "";
+
+	/* removed files are logged with the rest of their directory */
+	len = strlen(name);
+	if (len >= 5 && strcmp(name + len - 5, "Attic") == 0 && (len == 5 || name[len - 6] == '/'))
+	    name[len == 5 ? 0 : len - 6] = 0;
+
+	if (rep[0] && name[0])
+	    snprintf(path, PATH_MAX, "%s/%s", rep, name);
+	else
+	    snprintf(path, PATH_MAX, "%s", rep[0] ? rep : (name[0] ? name : "."));
+
+	if (get_hash_object(seen, path))
+	    continue;
+
+	if (num == max)
+	{
+	    max = max ? max * 2 : 64;
+	    if (!(*paths = (char **)realloc(*paths, max * sizeof(**paths))))
+	    {
+		debug(DEBUG_SYSERROR, "malloc failed for log paths");
+		exit(1);
+	    }
+	}
+
+	(*paths)[num] = xstrdup(path);
+	put_hash_object(seen, (*paths)[num], (*paths)[num]);
+	num++;
+    }
+
+    close_cvs_log(fp);
+    destroy_hash_table(seen, NULL);
+
+    if (ret < 0)
+    {
+	while (num > 0)
+	    free((*paths)[--num]);
+	free(*paths);
+	return -1;
+    }
+
+    return num;
+}
+
 static int usage(const char * str1, const char * str2)
 {
     if (str1)
@@ -617,7 +1001,11 @@ static int usage(const char * str1, const char * str2)
     debug(DEBUG_APPERROR, "             [--test-log <captured cvs log file>] [--bkcvs]");
     debug(DEBUG_APPERROR, "             [--no-rlog] [--diff-opts <option string>] [--cvs-direct]");
     debug(DEBUG_APPERROR, "             [--debuglvl <bitmask>] [-Z <compression>] [--root <cvsroot>]");
-    debug(DEBUG_APPERROR, "             [-q] [-A] [<repository>]");
+    debug(DEBUG_APPERROR, "             [-q] [-A] [--rev-cache] [--rev-cache-size <MB>]");
+    debug(DEBUG_APPERROR, "             [--diff-cache] [--prewarm-diffs <patchset>[-<patchset>]]");
+    debug(DEBUG_APPERROR, "             [--checkpoint] [--cvs-stats <file>] [--profile <file>]");
+    debug(DEBUG_APPERROR, "             [--fast-import] [--ndjson] [--threads <n>]");
+    debug(DEBUG_APPERROR, "             [<repository>]");
     debug(DEBUG_APPERROR, "");
     debug(DEBUG_APPERROR, "Where:");
     debug(DEBUG_APPERROR, "  -h display this informative message");
@@ -651,6 +1039,20 @@ static int usage(const char * str1, const char * str2)
     debug(DEBUG_APPERROR, "  --root <cvsroot> specify cvsroot.  overrides env. and working directory (cvs-direct only)");
     debug(DEBUG_APPERROR, "  -q be quiet about warnings");
     debug(DEBUG_APPERROR, "  -A track and report branch ancestry");
+    debug(DEBUG_APPERROR, "  --rev-cache keep fetched revisions in ~/.cvsps/revcache and diff them locally");
+    debug(DEBUG_APPERROR, "  --rev-cache-size <MB> limit the size of the revision cache (implies --rev-cache)");
+    debug(DEBUG_APPERROR, "  --diff-cache keep generated diffs in ~/.cvsps/diffcache and reuse them");
+    debug(DEBUG_APPERROR, "  --prewarm-diffs <patchset>[-<patchset>] fill the diff cache for the given");
+    debug(DEBUG_APPERROR, "                  patchsets in the background (implies --diff-cache)");
+    debug(DEBUG_APPERROR, "  --checkpoint save progress while reading the cvs log, and resume an");
+    debug(DEBUG_APPERROR, "               interrupted run from where it stopped");
+    debug(DEBUG_APPERROR, "  --cvs-stats <file> write cvs-direct protocol statistics as JSON to <file>");
+    debug(DEBUG_APPERROR, "                     at exit and on SIGUSR1 ('-' for stderr)");
+    debug(DEBUG_APPERROR, "  --profile <file> write time, memory and object counts of each phase");
+    debug(DEBUG_APPERROR, "                   of the run as JSON to <file>");
+    debug(DEBUG_APPERROR, "  --fast-import write the patch sets as a git fast-import stream");
+    debug(DEBUG_APPERROR, "  --ndjson write the patch sets as newline delimited JSON");
+    debug(DEBUG_APPERROR, "  --threads <n> resolve tags with <n> threads (default: one per CPU)");
     debug(DEBUG_APPERROR, "  <repository> apply cvsps to repository.  overrides working directory");
     debug(DEBUG_APPERROR, "\ncvsps version %s\n", VERSION);
 
@@ -956,6 +1358,108 @@ static int parse_args(int argc, char *argv[])
 	    continue;
 	}
 
+	if (strcmp(argv[i], "--rev-cache") == 0)
+	{
+	    rev_cache = 1;
+	    i++;
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--rev-cache-size") == 0)
+	{
+	    if (++i >= argc)
+		return usage("argument to --rev-cache-size missing", "");
+
+	    rev_cache = 1;
+	    rev_cache_size = atoi(argv[i++]);
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--diff-cache") == 0)
+	{
+	    diff_cache = 1;
+	    i++;
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--prewarm-diffs") == 0)
+	{
+	    char * min_str, * max_str;
+
+	    if (++i >= argc)
+		return usage("argument to --prewarm-diffs missing", "");
+
+	    min_str = argv[i++];
+	    max_str = strrchr(min_str, '-');
+	    if (max_str)
+		*max_str++ = '\0';
+	    else
+		max_str = min_str;
+
+	    prewarm_ps_min = atoi(min_str);
+	    prewarm_ps_max = *max_str ? atoi(max_str) : INT_MAX;
+
+	    if (prewarm_ps_min <= 0)
+		return usage("invalid patchset range for --prewarm-diffs", "");
+
+	    diff_cache = 1;
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--checkpoint") == 0)
+	{
+	    checkpoint = 1;
+	    i++;
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--profile") == 0)
+	{
+	    if (++i >= argc)
+		return usage("argument to --profile missing", "");
+
+	    profile_file = argv[i++];
+	    continue;
+	}
+
+	if (strncmp(argv[i], "--profile=", 10) == 0)
+	{
+	    profile_file = argv[i++] + 10;
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--fast-import") == 0)
+	{
+	    fast_import = 1;
+	    i++;
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--ndjson") == 0)
+	{
+	    ndjson = 1;
+	    i++;
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--threads") == 0)
+	{
+	    if (++i >= argc)
+		return usage("argument to --threads missing", "");
+
+	    num_threads = atoi(argv[i++]);
+	    continue;
+	}
+
+	if (strcmp(argv[i], "--cvs-stats") == 0)
+	{
+	    if (++i >= argc)
+		return usage("argument to --cvs-stats missing", "");
+
+	    cvs_stats_file = argv[i++];
+	    continue;
+	}
+
 	if (argv[i][0] == '-')
 	    return usage("invalid argument", argv[i]);
 	
@@ -1190,7 +1694,7 @@ static CvsFile * parse_rcs_file(const char * buff)
 	fn[len] = 0;
     }
 
-    debug(DEBUG_STATUS, "stripped filename %s", fn);
+    trace(TRACE_FILE, "stripped filename %s", fn);
 
     return build_file_by_name(fn);
 }
@@ -1205,7 +1709,7 @@ static CvsFile * parse_working_file(const char * buff)
     memcpy(fn, buff + 14, len);
     fn[len] = 0;
 
-    debug(DEBUG_STATUS, "working filename %s", fn);
+    trace(TRACE_FILE, "working filename %s", fn);
 
     return build_file_by_name(fn);
 }
@@ -1221,6 +1725,7 @@ static CvsFile * build_file_by_name(const char * fn)
 	if ((retval = create_cvsfile()))
 	{
 	    retval->filename = xstrdup(fn);
+	    profile_bytes(PROF_FILE, strlen(fn) + 1);
 	    put_hash_object_ex(file_hash, retval->filename, retval, HT_NO_KEYCOPY, NULL, NULL);
 	}
 	else
@@ -1229,11 +1734,11 @@ static CvsFile * build_file_by_name(const char * fn)
 	    exit(1);
 	}
 
-	debug(DEBUG_STATUS, "new file: %s", retval->filename);
+	trace(TRACE_FILE, "new file: %s", retval->filename);
     }
     else
     {
-	debug(DEBUG_STATUS, "existing file: %s", retval->filename);
+	trace(TRACE_FILE, "existing file: %s", retval->filename);
     }
 
     return retval;
@@ -1253,6 +1758,7 @@ PatchSet * get_patch_set(const char * dte, const char * log, const char * author
     convert_date(&retval->date, dte);
     retval->author = get_string(author);
     retval->descr = xstrdup(log);
+    profile_alloc(PROF_LOG, strlen(log) + 1);
     retval->branch = branch ? branch->sym : NULL;
     
     /* we are looking for a patchset suitable for holding this member.
@@ -1274,15 +1780,17 @@ PatchSet * get_patch_set(const char * dte, const char * log, const char * author
 
     if (*find != retval)
     {
-	debug(DEBUG_STATUS, "found existing patch set");
+	trace(TRACE_PATCHSET, "found existing patch set");
 
 	if (bkcvs && strstr(retval->descr, "BKrev:"))
 	{
+	    profile_free(PROF_LOG, strlen((*find)->descr) + 1);
 	    free((*find)->descr);
 	    (*find)->descr = retval->descr;
 	}
 	else
 	{
+	    profile_free(PROF_LOG, strlen(retval->descr) + 1);
 	    free(retval->descr);
 	}
 
@@ -1301,13 +1809,14 @@ PatchSet * get_patch_set(const char * dte, const char * log, const char * author
 	else if (retval->date + timestamp_fuzz_factor > (*find)->max_date)
 	    (*find)->max_date = retval->date + timestamp_fuzz_factor;
 
+	profile_free(PROF_PATCH_SET, sizeof(*retval));
 	free(retval);
 	retval = *find;
     }
     else
     {
-	debug(DEBUG_STATUS, "new patch set!");
-	debug(DEBUG_STATUS, "%s %s %s", retval->author, retval->descr, dte);
+	trace(TRACE_PATCHSET, "new patch set!");
+	trace(TRACE_PATCHSET, "%s %s %s", retval->author, retval->descr, dte);
 
 	retval->min_date = retval->date - timestamp_fuzz_factor;
 	retval->max_date = retval->date + timestamp_fuzz_factor;
@@ -1426,6 +1935,9 @@ static void assign_pre_revision(PatchSetMember * psm, CvsFileRevision * rev)
 
 static void check_print_patch_set(PatchSet * ps)
 {
+    /* cached diffs make no requests, see to SIGUSR1 here too */
+    cvs_direct_stats_poll();
+
     if (ps->psid < 0)
 	return;
 
@@ -1484,6 +1996,18 @@ static void check_print_patch_set(PatchSet * ps)
 	    return;
     }
 
+    if (fast_import)
+    {
+	fast_import_patch_set(ps);
+	return;
+    }
+
+    if (ndjson)
+    {
+	ndjson_patch_set(ps);
+	return;
+    }
+
     if (patch_set_dir)
     {
 	char path[PATH_MAX];
@@ -1513,18 +2037,22 @@ static void check_print_patch_set(PatchSet * ps)
     if (summary_first <= 1)
 	print_patch_set(ps);
     if (do_diff && summary_first != 1)
+    {
+	profile_begin("diff");
 	do_cvs_diff(ps);
+	profile_end();
+    }
 
     fflush(stdout);
 }
 
 static void print_patch_set(PatchSet * ps)
 {
-    struct tm *tm;
+    char date_str[DATE_STR_MAX];
     struct list_link * next;
     const char * funk = "";
 
-    tm = localtime(&ps->date);
+    format_date(date_str, DATE_STR_MAX, ps->date);
     next = ps->members.next;
     
     funk = fnk_descr[ps->funk_factor];
@@ -1532,9 +2060,7 @@ static void print_patch_set(PatchSet * ps)
     /* this '---...' is different from the 28 hyphens that separate cvs log output */
     printf("---------------------\n");
     printf("PatchSet %d %s\n", ps->psid, funk);
-    printf("Date: %d/%02d/%02d %02d:%02d:%02d\n", 
-	   1900 + tm->tm_year, tm->tm_mon + 1, tm->tm_mday, 
-	   tm->tm_hour, tm->tm_min, tm->tm_sec);
+    printf("Date: %s\n", date_str);
     printf("Author: %s\n", ps->author);
     printf("Branch: %s\n", PS_BRANCH(ps));
     if (ps->ancestor_branch)
@@ -1846,18 +2372,8 @@ static int patch_set_affects_branch(PatchSet * ps, const char * branch)
     return 0;
 }
 
-static void do_cvs_diff(PatchSet * ps)
+static void get_diff_type(DiffType * dt)
 {
-    struct list_link * next;
-    const char * dtype;
-    const char * dopts;
-    const char * utype;
-    char use_rep_path[PATH_MAX];
-    char esc_use_rep_path[PATH_MAX];
-
-    fflush(stdout);
-    fflush(stderr);
-
     /* 
      * if cvs_direct is not in effect, and diff options are specified,
      * then we have to use diff instead of rdiff and we'll get a -p0 
@@ -1870,34 +2386,75 @@ static void do_cvs_diff(PatchSet * ps)
      */
     if (diff_opts == NULL) 
     {
-	dopts = "-u";
-	dtype = "rdiff";
-	utype = "co";
-	sprintf(use_rep_path, "%s/", repository_path);
+	dt->dopts = "-u";
+	dt->dtype = "rdiff";
+	dt->utype = "co";
+	if (snprintf(dt->use_rep_path, PATH_MAX, "%s/", repository_path) >= PATH_MAX)
+	{
+	    debug(DEBUG_APPERROR, "repository path too long: %s", repository_path);
+	    exit(1);
+	}
 	/* the rep_path may contain characters that the shell will barf on */
-	escape_filename(esc_use_rep_path, PATH_MAX, use_rep_path);
+	escape_filename(dt->esc_use_rep_path, sizeof(dt->esc_use_rep_path), dt->use_rep_path);
     }
     else
     {
-	dopts = diff_opts;
-	dtype = "diff";
-	utype = "update";
-	use_rep_path[0] = 0;
-	esc_use_rep_path[0] = 0;
+	dt->dopts = diff_opts;
+	dt->dtype = "diff";
+	dt->utype = "update";
+	dt->use_rep_path[0] = 0;
+	dt->esc_use_rep_path[0] = 0;
     }
+}
 
-    for (next = ps->members.next; next != &ps->members; next = next->next)
-    {
-	PatchSetMember * psm = list_entry(next, PatchSetMember, link);
-	char cmdbuff[PATH_MAX * 2+1];
-	char esc_file[PATH_MAX];
-	int ret, check_ret = 0;
+static void do_cvs_diff(PatchSet * ps)
+{
+    struct list_link * next;
+    DiffType dt;
+    PatchSetMember ** batch = NULL;
+    BatchedDiff * batched = NULL;
+    BatchedDiff ** batch_diffs = NULL;
+    int num_members = 0;
+    int i;
 
-	cmdbuff[0] = 0;
-	cmdbuff[PATH_MAX*2] = 0;
+    fflush(stdout);
+    fflush(stderr);
 
-	/* the filename may contain characters that the shell will barf on */
-	escape_filename(esc_file, PATH_MAX, psm->file->filename);
+    get_diff_type(&dt);
+
+    /*
+     * without cvs_direct, each diff costs a shell and a cvs process, so 
+     * members are diffed together where one command can do them all. the
+     * caches need the diff of each member on its own, so don't batch then
+     */
+    if (!cvs_direct && !rev_cache && !diff_cache)
+    {
+	for (next = ps->members.next; next != &ps->members; next = next->next)
+	    num_members++;
+
+	batch = (PatchSetMember **)malloc(num_members * sizeof(*batch));
+	batch_diffs = (BatchedDiff **)malloc(num_members * sizeof(*batch_diffs));
+	batched = (BatchedDiff *)calloc(num_members, sizeof(*batched));
+
+	if (!batch || !batch_diffs || !batched)
+	{
+	    debug(DEBUG_SYSERROR, "malloc failed for batched diff");
+	    exit(1);
+	}
+    }
+
+    for (next = ps->members.next, i = 0; next != &ps->members; next = next->next, i++)
+    {
+	PatchSetMember * psm = list_entry(next, PatchSetMember, link);
+	char args[BATCH_ARGS_MAX];
+
+	/* diffed earlier in a batch, print it in the place it would have had */
+	if (batched && batched[i].done)
+	{
+	    fwrite(batched[i].text, 1, batched[i].len, stdout);
+	    fflush(stdout);
+	    continue;
+	}
 
 	/*
 	 * Check the patchset funk. we may not want to diff this particular file 
@@ -1917,84 +2474,726 @@ static void do_cvs_diff(PatchSet * ps)
 	    continue;
 	}
 
-	/* 
-	 * When creating diffs for INITIAL or DEAD revisions, we have to use 'cvs co'
-	 * or 'cvs update' to get the file, because cvs won't generate these diffs.
-	 * The problem is that this must be piped to diff, and so the resulting
-	 * diff doesn't contain the filename anywhere! (diff between - and /dev/null).
-	 * sed is used to replace the '-' with the filename. 
-	 *
-	 * It's possible for pre_rev to be a 'dead' revision. This happens when a file 
-	 * is added on a branch. post_rev will be dead dead for remove
-	 */
-	if (!psm->pre_rev || psm->pre_rev->dead || psm->post_rev->dead)
+	if (diff_cache)
 	{
-	    int cr;
-	    const char * rev;
+	    char path[PATH_MAX];
 
-	    if (!psm->pre_rev || psm->pre_rev->dead)
+	    get_diffcache_entry(psm, &dt, path);
+
+	    if (diffcache_print(path, stdout) < 0)
+		exit(1);
+
+	    fflush(stdout);
+	    continue;
+	}
+
+	if (batched && !batched[i].failed && get_batch_args(ps, psm, args))
+	{
+	    struct list_link * next2;
+	    int n = 0, j, cmdlen = 0;
+
+	    /* collect the rest of the members which take the same arguments */
+	    for (next2 = next, j = i; next2 != &ps->members; next2 = next2->next, j++)
 	    {
-		cr = 1;
-		rev = psm->post_rev->rev;
+		PatchSetMember * psm2 = list_entry(next2, PatchSetMember, link);
+		char args2[BATCH_ARGS_MAX];
+
+		if (batched[j].failed || !get_batch_args(ps, psm2, args2) || strcmp(args, args2) != 0)
+		    continue;
+
+		/* escaping can double the length of a filename, plus the repository path */
+		cmdlen += 2 * strlen(psm2->file->filename) + strlen(dt.esc_use_rep_path) + 1;
+		if (cmdlen > BATCH_CMD_MAX - PATH_MAX)
+		    break;
+
+		batch[n] = psm2;
+		batch_diffs[n] = &batched[j];
+		n++;
 	    }
-	    else
+
+	    if (n > 1 && do_batched_diff(batch, batch_diffs, n, args, &dt) == 0)
 	    {
-		cr = 0;
-		rev = psm->pre_rev->rev;
+		fwrite(batched[i].text, 1, batched[i].len, stdout);
+		fflush(stdout);
+		continue;
 	    }
 
-	    if (cvs_direct_ctx)
+	    /* diff them one at a time when their turn comes */
+	    for (j = 0; j < n; j++)
+		batch_diffs[j]->failed = 1;
+	}
+
+	do_member_diff(psm, &dt);
+    }
+
+    if (batched)
+    {
+	for (i = 0; i < num_members; i++)
+	    free(batched[i].output);
+    }
+
+    free(batch);
+    free(batch_diffs);
+    free(batched);
+}
+
+/*
+ * Fill in 'args' with the revision arguments a batched diff of this
+ * member would use, or return 0 if it can't be diffed in a batch: only
+ * regular diffs qualify, as INITIAL and DEAD revisions need 'co' or
+ * 'update', and funky members aren't diffed at all.
+ *
+ * Where a pair of dates picks the member's revisions, the arguments are
+ * '-D <before the patchset> -D <end of the patchset>', which are the
+ * same for most members of a patchset;  otherwise they are the '-r' pair
+ * of the revisions, which only members with the same revisions share.
+ */
+static int get_batch_args(PatchSet * ps, PatchSetMember * psm, char * args)
+{
+    if (ps->funk_factor == FNK_SHOW_SOME && psm->bad_funk)
+	return 0;
+
+    if (ps->funk_factor == FNK_HIDE_SOME && !psm->bad_funk)
+	return 0;
+
+    if (!psm->pre_rev || psm->pre_rev->dead || psm->post_rev->dead)
+	return 0;
+
+    if (dates_select_member(ps, psm))
+    {
+	char before[64], end[64];
+	time_t t;
+
+	/* formatted like the rlog -d dates */
+	t = ps->date - 1;
+	strftime(before, sizeof(before), "%d %b %Y %H:%M:%S %z", gmtime(&t));
+	strftime(end, sizeof(end), "%d %b %Y %H:%M:%S %z", gmtime(&ps->max_date));
+	snprintf(args, BATCH_ARGS_MAX, "-D '%s' -D '%s'", before, end);
+    }
+    else
+    {
+	snprintf(args, BATCH_ARGS_MAX, "-r %s -r %s", psm->pre_rev->rev, psm->post_rev->rev);
+    }
+
+    return 1;
+}
+
+/*
+ * Do 'cvs rdiff -D <ps->date - 1> -D <ps->max_date>' pick the pre and
+ * post revisions of this trunk member?  A date picks the highest trunk
+ * revision committed no later than it.  Only the window a patchset's
+ * members were committed in is known: from ps->date (the first) up to
+ * ps->max_date (the last, plus up to the fuzz factor), so the check
+ * errs on the side of falling back to the revision numbers.
+ */
+static int dates_select_member(PatchSet * ps, PatchSetMember * psm)
+{
+    CvsFileRevision * rev;
+
+    if (ps->branch != &head_sym || !is_trunk_rev(psm->pre_rev->rev) || !is_trunk_rev(psm->post_rev->rev))
+	return 0;
+
+    /* with an imported vendor branch, dates may pick its revisions */
+    if (get_hash_object(psm->file->revisions, "1.1.1.1"))
+	return 0;
+
+    /* the pre revision is no later than the first date */
+    if (!psm->pre_rev->post_psm || psm->pre_rev->post_psm->ps->max_date >= ps->date)
+	return 0;
+
+    /* and every later trunk revision is after the second */
+    for (rev = psm->post_rev; rev->pre_psm; rev = rev->pre_psm->post_rev)
+	if (rev->pre_psm->ps->date <= ps->max_date)
+	    return 0;
+
+    return 1;
+}
+
+static int is_trunk_rev(const char * rev)
+{
+    const char * p = strchr(rev, '.');
+
+    return (p && !strchr(p + 1, '.'));
+}
+
+/*
+ * Diff several members with a single 'cvs rdiff' (or 'cvs diff') with
+ * multiple file arguments.  The output is collected and split at the
+ * 'Index:' line heading each file, so the caller can print each member
+ * in its own place.  Nothing is written, and -1 returned, if the command
+ * fails or the output can't be matched up with the members, in which
+ * case they should be diffed on their own.
+ */
+static int do_batched_diff(PatchSetMember ** members, BatchedDiff ** diffs, int n, const char * args, DiffType * dt)
+{
+    char * cmdbuff;
+    char * p;
+    char esc_file[PATH_MAX * 2];
+    char * out = NULL;
+    int outlen = 0, outmax = 0;
+    int i, len, ret, stat, check_ret = 0;
+    FILE * fp;
+
+    if (!(cmdbuff = malloc(BATCH_CMD_MAX)))
+	return -1;
+
+    len = snprintf(cmdbuff, BATCH_CMD_MAX, "cvs %s %s %s %s %s",
+		   compress_arg, norc, dt->dtype, dt->dopts, args);
+
+    for (i = 0; i < n; i++)
+    {
+	/* the filename may contain characters that the shell will barf on */
+	escape_filename(esc_file, sizeof(esc_file), members[i]->file->filename);
+	len += snprintf(cmdbuff + len, BATCH_CMD_MAX - len, " %s%s", dt->esc_use_rep_path, esc_file);
+    }
+
+    /* 'cvs diff' exit status '1' is ok, just means files are different */
+    if (strcmp(dt->dtype, "diff") == 0)
+	check_ret = 1;
+
+    debug(DEBUG_STATUS, "batched diff: %s", cmdbuff);
+
+    if (!(fp = popen(cmdbuff, "r")))
+    {
+	free(cmdbuff);
+	return -1;
+    }
+
+    free(cmdbuff);
+
+    while (1)
+    {
+	/* room for the terminating nul is kept */
+	if (outmax - outlen <= BUFSIZ)
+	{
+	    outmax = outmax ? outmax * 2 : BUFSIZ * 4;
+	    if (!(p = realloc(out, outmax)))
 	    {
-		/* cvs_rupdate does the pipe through diff thing internally */
-		cvs_rupdate(cvs_direct_ctx, repository_path, psm->file->filename, rev, cr, dopts);
+		debug(DEBUG_SYSERROR, "malloc failed for batched diff output");
+		exit(1);
 	    }
-	    else
+	    out = p;
+	}
+
+	if ((len = fread(out + outlen, 1, outmax - outlen - 1, fp)) <= 0)
+	    break;
+
+	outlen += len;
+    }
+
+    out[outlen] = 0;
+
+    ret = pclose(fp);
+    stat = WEXITSTATUS(ret);
+
+    if (ret < 0 || WIFSIGNALED(ret) || stat > check_ret)
+    {
+	debug(DEBUG_APPMSG1, "WARNING: batched diff failed with exit status %d, diffing files one at a time", stat);
+	free(out);
+	return -1;
+    }
+
+    if (split_batched_diff(out, members, diffs, n, dt) < 0)
+    {
+	debug(DEBUG_APPMSG1, "WARNING: unexpected batched diff output, diffing files one at a time");
+	free(out);
+	return -1;
+    }
+
+    diffs[0]->output = out;
+
+    return 0;
+}
+
+/*
+ * Point each member's diff at its part of the output of a batched diff.
+ * A member without an 'Index:' line has no differences, as it would if
+ * it had been diffed on its own.
+ */
+static int split_batched_diff(char * out, PatchSetMember ** members, BatchedDiff ** diffs, int n, DiffType * dt)
+{
+    BatchedDiff * cur = NULL;
+    char * p = out;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+	diffs[i]->text = "";
+	diffs[i]->len = 0;
+    }
+
+    while (*p)
+    {
+	char * eol = strchr(p, '\n');
+	char * next = eol ? eol + 1 : p + strlen(p);
+
+	if (strncmp(p, "Index: ", 7) == 0)
+	{
+	    const char * name = p + 7;
+	    int name_len = (eol ? eol : next) - name;
+	    int rep_len = strlen(dt->use_rep_path);
+
+	    /* rdiff names files by repository path, diff by filename */
+	    for (i = 0; i < n; i++)
 	    {
-		snprintf(cmdbuff, PATH_MAX * 2, "cvs %s %s %s -p -r %s %s%s | diff %s %s /dev/null %s | sed -e '%s s|^\\([+-][+-][+-]\\) -|\\1 %s%s|g'",
-			 compress_arg, norc, utype, rev, esc_use_rep_path, esc_file, dopts,
-			 cr?"":"-",cr?"-":"", cr?"2":"1",
-			 use_rep_path, psm->file->filename);
+		const char * filename = members[i]->file->filename;
+
+		if (name_len == rep_len + (int)strlen(filename) &&
+		    strncmp(name, dt->use_rep_path, rep_len) == 0 &&
+		    strncmp(name + rep_len, filename, name_len - rep_len) == 0)
+		    break;
 	    }
+
+	    if (i == n || diffs[i]->len)
+		return -1;
+
+	    cur = diffs[i];
+	    cur->text = p;
+	}
+	else if (!cur)
+	{
+	    return -1;
+	}
+
+	cur->len += next - p;
+	p = next;
+    }
+
+    for (i = 0; i < n; i++)
+	diffs[i]->done = 1;
+
+    return 0;
+}
+
+/*
+ * Generate the diff for a single patchset member to stdout
+ */
+static void do_member_diff(PatchSetMember * psm, DiffType * dt)
+{
+    char cmdbuff[PATH_MAX * 8];
+    char esc_file[PATH_MAX * 2];
+    int len = 0, ret, check_ret = 0;
+
+    cmdbuff[0] = 0;
+
+    /*
+     * With the revision cache, both sides of the diff come from
+     * local copies, and only missing revisions are fetched.
+     */
+    if (rev_cache)
+    {
+	do_cached_diff(psm, dt->dopts);
+	return;
+    }
+
+    open_cvs_direct_lazily();
+
+    /* the filename may contain characters that the shell will barf on */
+    escape_filename(esc_file, sizeof(esc_file), psm->file->filename);
+
+    /* 
+     * When creating diffs for INITIAL or DEAD revisions, we have to use 'cvs co'
+     * or 'cvs update' to get the file, because cvs won't generate these diffs.
+     * The problem is that this must be piped to diff, and so the resulting
+     * diff doesn't contain the filename anywhere! (diff between - and /dev/null).
+     * sed is used to replace the '-' with the filename. 
+     *
+     * It's possible for pre_rev to be a 'dead' revision. This happens when a file 
+     * is added on a branch. post_rev will be dead dead for remove
+     */
+    if (!psm->pre_rev || psm->pre_rev->dead || psm->post_rev->dead)
+    {
+	int cr;
+	const char * rev;
+
+	if (!psm->pre_rev || psm->pre_rev->dead)
+	{
+	    cr = 1;
+	    rev = psm->post_rev->rev;
 	}
 	else
 	{
-	    /* a regular diff */
-	    if (cvs_direct_ctx)
-	    {
-		cvs_diff(cvs_direct_ctx, repository_path, psm->file->filename, psm->pre_rev->rev, psm->post_rev->rev, dopts);
-	    }
-	    else
-	    {
-		/* 'cvs diff' exit status '1' is ok, just means files are different */
-		if (strcmp(dtype, "diff") == 0)
-		    check_ret = 1;
+	    cr = 0;
+	    rev = psm->pre_rev->rev;
+	}
 
-		snprintf(cmdbuff, PATH_MAX * 2, "cvs %s %s %s %s -r %s -r %s %s%s",
-			 compress_arg, norc, dtype, dopts, psm->pre_rev->rev, psm->post_rev->rev, 
-			 esc_use_rep_path, esc_file);
-	    }
+	if (cvs_direct_ctx)
+	{
+	    /* cvs_rupdate does the pipe through diff thing internally */
+	    cvs_rupdate(cvs_direct_ctx, repository_path, psm->file->filename, rev, cr, dt->dopts);
+	}
+	else
+	{
+	    len = snprintf(cmdbuff, sizeof(cmdbuff), "cvs %s %s %s -p -r %s %s%s | diff %s %s /dev/null %s | sed -e '%s s|^\\([+-][+-][+-]\\) -|\\1 %s%s|g'",
+		     compress_arg, norc, dt->utype, rev, dt->esc_use_rep_path, esc_file, dt->dopts,
+		     cr?"":"-",cr?"-":"", cr?"2":"1",
+		     dt->use_rep_path, psm->file->filename);
 	}
+    }
+    else
+    {
+	/* a regular diff */
+	if (cvs_direct_ctx)
+	{
+	    cvs_diff(cvs_direct_ctx, repository_path, psm->file->filename, psm->pre_rev->rev, psm->post_rev->rev, dt->dopts);
+	}
+	else
+	{
+	    /* 'cvs diff' exit status '1' is ok, just means files are different */
+	    if (strcmp(dt->dtype, "diff") == 0)
+		check_ret = 1;
 
-	/*
-	 * my_system doesn't block signals the way system does.
-	 * if ctrl-c is pressed while in there, we probably exit
-	 * immediately and hope the shell has sent the signal
-	 * to all of the process group members
+	    len = snprintf(cmdbuff, sizeof(cmdbuff), "cvs %s %s %s %s -r %s -r %s %s%s",
+		     compress_arg, norc, dt->dtype, dt->dopts, psm->pre_rev->rev, psm->post_rev->rev, 
+		     dt->esc_use_rep_path, esc_file);
+	}
+    }
+
+    if (len >= (int)sizeof(cmdbuff))
+    {
+	debug(DEBUG_APPERROR, "diff command too long for %s", psm->file->filename);
+	exit(1);
+    }
+
+    /*
+     * my_system doesn't block signals the way system does.
+     * if ctrl-c is pressed while in there, we probably exit
+     * immediately and hope the shell has sent the signal
+     * to all of the process group members
+     */
+    if (cmdbuff[0] && (ret = my_system(cmdbuff)))
+    {
+	int stat = WEXITSTATUS(ret);
+	
+	/* 
+	 * cvs diff returns 1 in exit status for 'files are different'
+	 * so use a better method to check for failure
 	 */
-	if (cmdbuff[0] && (ret = my_system(cmdbuff)))
+	if (stat < 0 || stat > check_ret || WIFSIGNALED(ret))
 	{
-	    int stat = WEXITSTATUS(ret);
-	    
-	    /* 
-	     * cvs diff returns 1 in exit status for 'files are different'
-	     * so use a better method to check for failure
-	     */
-	    if (stat < 0 || stat > check_ret || WIFSIGNALED(ret))
-	    {
-		debug(DEBUG_APPERROR, "system command returned non-zero exit status: %d: aborting", stat);
-		exit(1);
-	    }
+	    debug(DEBUG_APPERROR, "system command returned non-zero exit status: %d: aborting", stat);
+	    exit(1);
+	}
+    }
+}
+
+/*
+ * Look up the diff cache entry for a member, see diffcache_lookup().
+ * The key includes everything which changes the generated output.
+ */
+static int lookup_diffcache_entry(PatchSetMember * psm, DiffType * dt, char * path, char * tmp)
+{
+    char key[CACHE_KEY_MAX];
+
+    if (snprintf(key, sizeof(key), "%s\n%s%s\n%s%s\n%s\n%s",
+		 psm->file->filename,
+		 psm->pre_rev ? psm->pre_rev->rev : "INITIAL",
+		 (psm->pre_rev && psm->pre_rev->dead) ? "(DEAD)" : "",
+		 psm->post_rev->rev,
+		 psm->post_rev->dead ? "(DEAD)" : "",
+		 dt->dopts,
+		 rev_cache ? "local" : (cvs_direct ? "direct" : dt->dtype)) >= (int)sizeof(key))
+    {
+	debug(DEBUG_APPERROR, "diff cache key too long for %s", psm->file->filename);
+	exit(1);
+    }
+
+    return diffcache_lookup(key, path, tmp);
+}
+
+/*
+ * Fill in 'path' with the diff cache entry for a member, generating
+ * the diff and storing it first if it isn't cached yet.
+ */
+static void get_diffcache_entry(PatchSetMember * psm, DiffType * dt, char * path)
+{
+    char tmp[PATH_MAX];
+    int fd, save_fd;
+
+    if (lookup_diffcache_entry(psm, dt, path, tmp))
+	return;
+
+    /* 
+     * the method is only known once the connection has been tried:
+     * if cvs_direct fails, the diff comes from the cvs client
+     */
+    if (!rev_cache && cvs_direct)
+    {
+	open_cvs_direct_lazily();
+
+	if (!cvs_direct && lookup_diffcache_entry(psm, dt, path, tmp))
+	    return;
+    }
+
+    /* 
+     * the diff may come from child processes, so capture it by pointing
+     * file descriptor 1 at the temp file, like the -p option does
+     */
+    fflush(stdout);
+
+    if ((save_fd = dup(1)) < 0 || (fd = open(tmp, O_WRONLY|O_TRUNC|O_CREAT, 0666)) < 0)
+    {
+	debug(DEBUG_SYSERROR, "can't open diff cache temp file %s", tmp);
+	exit(1);
+    }
+
+    dup2(fd, 1);
+    close(fd);
+
+    do_member_diff(psm, dt);
+
+    fflush(stdout);
+    dup2(save_fd, 1);
+    close(save_fd);
+
+    if (diffcache_store(path, tmp) < 0)
+	exit(1);
+}
+
+/*
+ * Fill the diff cache for the patchsets in the --prewarm-diffs range
+ * in a background process, with its own server connection, so it can
+ * run alongside (or outlive) the normal output of this run
+ */
+static void prewarm_diff_cache()
+{
+    pid_t pid;
+    int fd;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    if ((pid = fork()) < 0)
+    {
+	debug(DEBUG_SYSERROR, "can't fork diff cache prewarm process");
+	return;
+    }
+
+    if (pid > 0)
+    {
+	debug(DEBUG_APPMSG1, "prewarming diff cache for patchsets %d-%d in process %d", 
+	      prewarm_ps_min, prewarm_ps_max, (int)pid);
+	return;
+    }
+
+    setsid();
+
+    if ((fd = open("/dev/null", O_RDWR)) >= 0)
+    {
+	dup2(fd, 0);
+	dup2(fd, 1);
+	close(fd);
+    }
+
+    /* 
+     * the parent owns any open connection, so don't touch it.
+     * do_member_diff will open a new one if needed
+     */
+    cvs_direct_ctx = NULL;
+
+    walk_all_patch_sets(prewarm_patch_set);
+
+    if (cvs_direct_ctx)
+	close_cvs_server(cvs_direct_ctx);
+
+    exit(0);
+}
+
+static void prewarm_patch_set(PatchSet * ps)
+{
+    struct list_link * next;
+    DiffType dt;
+
+    if (ps->psid < prewarm_ps_min || ps->psid > prewarm_ps_max)
+	return;
+
+    get_diff_type(&dt);
+
+    for (next = ps->members.next; next != &ps->members; next = next->next)
+    {
+	PatchSetMember * psm = list_entry(next, PatchSetMember, link);
+	char path[PATH_MAX];
+
+	get_diffcache_entry(psm, &dt, path);
+    }
+}
+
+/*
+ * With the revision or diff caches, the cvs_direct connection is only
+ * needed on a cache miss, so it is opened on first use
+ */
+static void open_cvs_direct_lazily()
+{
+    if (cvs_direct && !cvs_direct_ctx && !(cvs_direct_ctx = open_cvs_server(root_path, compress)))
+    {
+	debug(DEBUG_APPMSG1, "WARNING: cvs_direct connection failed, using cvs client");
+	cvs_direct = 0;
+    }
+}
+
+/*
+ * Generate the diff for one member from the revision cache.  The output
+ * mimics what the server would have sent: an rdiff style header for
+ * regular diffs and a diff against /dev/null for added and removed files.
+ * Like cvs_direct, this always generates -p1 style patches.
+ */
+static void do_cached_diff(PatchSetMember * psm, const char * dopts)
+{
+    char pre_path[PATH_MAX], post_path[PATH_MAX];
+    char esc_pre_path[PATH_MAX * 2], esc_post_path[PATH_MAX * 2];
+    char pre_label[LABEL_MAX], post_label[LABEL_MAX];
+    char esc_pre_label[LABEL_MAX * 2], esc_post_label[LABEL_MAX * 2];
+    char * cmdbuff;
+    int cmdlen, ret;
+
+    strcpy(pre_path, "/dev/null");
+    strcpy(post_path, "/dev/null");
+    strcpy(pre_label, "/dev/null");
+    strcpy(post_label, "/dev/null");
+
+    if (psm->pre_rev && !psm->pre_rev->dead)
+    {
+	/* storing the post revision must not evict this one */
+	get_cached_revision(pre_path, psm->file, psm->pre_rev->rev);
+	revcache_pin(pre_path);
+	snprintf(pre_label, LABEL_MAX, "%s/%s", repository_path, psm->file->filename);
+    }
+
+    if (!psm->post_rev->dead)
+    {
+	get_cached_revision(post_path, psm->file, psm->post_rev->rev);
+	snprintf(post_label, LABEL_MAX, "%s/%s", repository_path, psm->file->filename);
+    }
+
+    if (psm->pre_rev && !psm->pre_rev->dead && !psm->post_rev->dead)
+    {
+	snprintf(pre_label, LABEL_MAX, "%s/%s:%s", repository_path, psm->file->filename, psm->pre_rev->rev);
+	snprintf(post_label, LABEL_MAX, "%s/%s:%s", repository_path, psm->file->filename, psm->post_rev->rev);
+	printf("Index: %s/%s\n", repository_path, psm->file->filename);
+	printf("diff %s %s %s\n", dopts, pre_label, post_label);
+	fflush(stdout);
+    }
+
+    /* escaping at most doubles the length */
+    escape_filename(esc_pre_path, sizeof(esc_pre_path), pre_path);
+    escape_filename(esc_post_path, sizeof(esc_post_path), post_path);
+    escape_filename(esc_pre_label, sizeof(esc_pre_label), pre_label);
+    escape_filename(esc_post_label, sizeof(esc_post_label), post_label);
+
+    cmdlen = strlen(dopts) + strlen(esc_pre_label) + strlen(esc_post_label) +
+	strlen(esc_pre_path) + strlen(esc_post_path) + 32;
+
+    if (!(cmdbuff = malloc(cmdlen)))
+    {
+	debug(DEBUG_SYSERROR, "malloc failed for cached diff command");
+	exit(1);
+    }
+
+    snprintf(cmdbuff, cmdlen, "diff %s -L %s -L %s %s %s",
+	     dopts, esc_pre_label, esc_post_label, esc_pre_path, esc_post_path);
+
+    debug(DEBUG_STATUS, "cached diff: %s", cmdbuff);
+
+    /* diff exit status '1' is ok, just means files are different */
+    if ((ret = my_system(cmdbuff)) && (WIFSIGNALED(ret) || WEXITSTATUS(ret) > 1))
+    {
+	debug(DEBUG_APPERROR, "system command returned non-zero exit status: %d: aborting", WEXITSTATUS(ret));
+	exit(1);
+    }
+
+    free(cmdbuff);
+    revcache_unpin();
+}
+
+/*
+ * Fill in 'path' with the location of a local copy of file:rev,
+ * fetching it with 'co' when it isn't in the revision cache yet
+ */
+static void get_cached_revision(char * path, CvsFile * file, const char * rev)
+{
+    char tmp[PATH_MAX];
+
+    if (revcache_lookup(file->filename, rev, path, tmp))
+	return;
+
+    fetch_revision(tmp, file, rev);
+
+    if (revcache_store(path, tmp) < 0)
+	exit(1);
+}
+
+/*
+ * Fill in 'path' with the location of a local copy of file:rev.  Returns
+ * 1 if it is a temporary file the caller must remove, 0 if it is in the
+ * revision cache.
+ */
+int get_revision_file(char * path, CvsFile * file, const char * rev)
+{
+    if (rev_cache)
+    {
+	get_cached_revision(path, file, rev);
+	return 0;
+    }
+
+    snprintf(path, PATH_MAX, "%s/revision.%d.tmp", get_cvsps_dir(), (int)getpid());
+    fetch_revision(path, file, rev);
+    return 1;
+}
+
+/*
+ * Write file:rev to 'path' with 'co', or 'co -p' without cvs_direct
+ */
+static void fetch_revision(const char * path, CvsFile * file, const char * rev)
+{
+    int ret;
+
+    open_cvs_direct_lazily();
+
+    if (cvs_direct_ctx)
+    {
+	FILE * fp;
+	int mode;
+
+	if (!(fp = fopen(path, "w")))
+	{
+	    debug(DEBUG_SYSERROR, "can't open revision file %s", path);
+	    exit(1);
 	}
+
+	ret = cvs_co(cvs_direct_ctx, repository_path, file->filename, rev, fp, &mode);
+
+	/* the executable bit is kept on the file, for fast-import */
+	if (mode & 0100)
+	    fchmod(fileno(fp), 0755);
+
+	if (fclose(fp) != 0)
+	    ret = -1;
+    }
+    else
+    {
+	char use_rep_path[PATH_MAX + 1];
+	char esc_use_rep_path[PATH_MAX * 2];
+	char esc_file[PATH_MAX * 2];
+	char esc_path[PATH_MAX * 2];
+	char cmdbuff[PATH_MAX * 8];
+
+	/* escaping at most doubles the length */
+	snprintf(use_rep_path, sizeof(use_rep_path), "%s/", repository_path);
+	escape_filename(esc_use_rep_path, sizeof(esc_use_rep_path), use_rep_path);
+	escape_filename(esc_file, sizeof(esc_file), file->filename);
+	escape_filename(esc_path, sizeof(esc_path), path);
+
+	snprintf(cmdbuff, sizeof(cmdbuff), "cvs %s %s -Q co -p -r %s %s%s > %s",
+		 compress_arg, norc, rev, esc_use_rep_path, esc_file, esc_path);
+
+	ret = my_system(cmdbuff);
+    }
+
+    if (ret)
+    {
+	debug(DEBUG_APPERROR, "can't fetch revision %s of file %s: aborting", rev, file->filename);
+	unlink(path);
+	exit(1);
     }
 }
 
@@ -2037,6 +3236,7 @@ CvsFileRevision * cvs_file_add_revision(CvsFile * file, const char * rev_str)
     if (!(rev = (CvsFileRevision*)get_hash_object(file->revisions, rev_str)))
     {
 	rev = (CvsFileRevision*)calloc(1, sizeof(*rev));
+	profile_alloc(PROF_REVISION, sizeof(*rev));
 	rev->rev = get_string(rev_str);
 	rev->file = file;
 	rev->branch = NULL;
@@ -2048,11 +3248,11 @@ CvsFileRevision * cvs_file_add_revision(CvsFile * file, const char * rev_str)
 	
 	put_hash_object_ex(file->revisions, rev->rev, rev, HT_NO_KEYCOPY, NULL, NULL);
 
-	debug(DEBUG_STATUS, "added revision %s to file %s", rev_str, file->filename);
+	trace(TRACE_FILE, "added revision %s to file %s", rev_str, file->filename);
     }
     else
     {
-	debug(DEBUG_STATUS, "found revision %s to file %s", rev_str, file->filename);
+	trace(TRACE_FILE, "found revision %s to file %s", rev_str, file->filename);
     }
 
     /* 
@@ -2091,6 +3291,7 @@ CvsFileRevision * cvs_file_add_revision(CvsFile * file, const char * rev_str)
 	    if (!rev->branch) {
 		debug(DEBUG_APPMSG1, "WARNING: revision %s of file %s on unnamed branch", rev->rev, rev->file->filename);
 		Tag *tag = (Tag*)calloc(1, sizeof(*tag));
+		profile_alloc(PROF_TAG, sizeof(*tag));
 		tag->branch = branch_id;
 		tag->rev = brev;
 		rev->branch = tag;
@@ -2102,7 +3303,7 @@ CvsFileRevision * cvs_file_add_revision(CvsFile * file, const char * rev_str)
 	    rev->branch = &head_tag;
 	}
 	
-	debug(DEBUG_STATUS, "revision %s of file %s on branch %s", rev->rev, rev->file->filename, BRANCH_NAME(rev->branch->sym));
+	trace(TRACE_FILE, "revision %s of file %s on branch %s", rev->rev, rev->file->filename, BRANCH_NAME(rev->branch->sym));
     }
 
     return rev;
@@ -2114,6 +3315,8 @@ CvsFile * create_cvsfile()
     if (!f)
 	return NULL;
 
+    profile_alloc(PROF_FILE, sizeof(*f));
+
     f->revisions = create_hash_table(53);
     f->symbols = create_hash_table(253);
     f->have_branches = 0;
@@ -2140,6 +3343,7 @@ static PatchSet * create_patch_set()
     
     if (ps)
     {
+	profile_alloc(PROF_PATCH_SET, sizeof(*ps));
 	INIT_LIST_HEAD(&ps->members);
 	ps->psid = -1;
 	ps->date = 0;
@@ -2160,6 +3364,7 @@ static PatchSet * create_patch_set()
 PatchSetMember * create_patch_set_member()
 {
     PatchSetMember * psm = (PatchSetMember*)calloc(1, sizeof(*psm));
+    profile_alloc(PROF_MEMBER, sizeof(*psm));
     psm->pre_rev = NULL;
     psm->post_rev = NULL;
     psm->ps = NULL;
@@ -2228,7 +3433,7 @@ static void parse_sym(CvsFile * file, char * sym)
     {
 	if (strcmp(tag, "TRUNK") == 0)
 	{
-	    debug(DEBUG_STATUS, "ignoring the TRUNK branch/tag");
+	    trace(TRACE_FILE, "ignoring the TRUNK branch/tag");
 	    return;
 	}
 	debug(DEBUG_APPERROR, "malformed revision");
@@ -2243,7 +3448,7 @@ static void parse_sym(CvsFile * file, char * sym)
 
     if (final_branch == 0)
     {
-	debug(DEBUG_STATUS, "got sym: %s for %s.%d", tag, rev2, leaf);
+	trace(TRACE_FILE, "got sym: %s for %s.%d", tag, rev2, leaf);
 	
 	cvs_file_add_symbol(file, rev2, tag, leaf);
     }
@@ -2270,7 +3475,7 @@ void cvs_file_add_symbol(CvsFile * file, const char * rev_str, const char * p_ta
     /* get a permanent storage string */
     char * tag_str = get_string(p_tag_str);
 
-    debug(DEBUG_STATUS, "adding symbol to file: %s %s->%s.%d", file->filename, tag_str, rev_str, branch);
+    trace(TRACE_FILE, "adding symbol to file: %s %s->%s.%d", file->filename, tag_str, rev_str, branch);
     
     /*
      * check the global_symbols
@@ -2279,6 +3484,7 @@ void cvs_file_add_symbol(CvsFile * file, const char * rev_str, const char * p_ta
     if (!sym)
     {
 	sym = (GlobalSymbol*)malloc(sizeof(*sym));
+	profile_alloc(PROF_SYMBOL, sizeof(*sym));
 	sym->tag = tag_str;
 	sym->ps = NULL;
 	INIT_LIST_HEAD(&sym->tags);
@@ -2303,7 +3509,7 @@ void cvs_file_add_symbol(CvsFile * file, const char * rev_str, const char * p_ta
 	{
 	    if (!tag->sym)
 	    {
-		debug(DEBUG_STATUS, "filling in branch name %s.%d:%s on %s", rev_str, branch, tag_str, file->filename);
+		trace(TRACE_FILE, "filling in branch name %s.%d:%s on %s", rev_str, branch, tag_str, file->filename);
 		tag->sym = sym;
 		list_add(&tag->global_link, &sym->tags);
 	    }
@@ -2314,6 +3520,7 @@ void cvs_file_add_symbol(CvsFile * file, const char * rev_str, const char * p_ta
     }
 
     tag = (Tag*)malloc(sizeof(*tag));
+    profile_alloc(PROF_TAG, sizeof(*tag));
     tag->rev = rev;
     tag->sym = sym;
     tag->branch = branch;
@@ -2340,113 +3547,257 @@ void cvs_file_add_symbol(CvsFile * file, const char * rev_str, const char * p_ta
  * the 'tagged' PatchSet.
  */
 
+/*
+ * Symbols are resolved in two steps.  resolve_symbol() finds the patch
+ * set of a symbol and the changes to make for it, but changes nothing
+ * itself, so the symbols are done in parallel.  apply_symbol() then
+ * makes the changes one symbol at a time, in hash order, so that the
+ * tags, flags, funk factors and messages are those of a serial run.
+ */
 static void resolve_global_symbols()
 {
     struct hash_entry * he_sym;
+    SymbolResolution * res;
+    int num_syms = 0;
+    int i;
+
     reset_hash_iterator(global_symbols);
     while ((he_sym = next_hash_entry(global_symbols)))
+	num_syms++;
+
+    res = (SymbolResolution *)calloc(num_syms + 1, sizeof(*res));
+    if (!res)
     {
-	GlobalSymbol * sym = (GlobalSymbol*)he_sym->he_obj;
-	PatchSet * ps = NULL;
-	struct list_link * next;
+	debug(DEBUG_SYSERROR, "malloc failed for symbol resolution");
+	exit(1);
+    }
 
-	debug(DEBUG_STATUS, "resolving global symbol %s", sym->tag);
+    i = 0;
+    reset_hash_iterator(global_symbols);
+    while ((he_sym = next_hash_entry(global_symbols)))
+	res[i++].sym = (GlobalSymbol*)he_sym->he_obj;
 
-	/*
-	 * First pass, determine the most recent PatchSet with a 
-	 * revision tagged with the symbolic tag.  This is 'the'
-	 * patchset with the tag
-	 */
+    workpool_run(num_threads > 0 ? num_threads : workpool_default_threads(),
+		 num_syms, resolve_symbol, res);
 
-	for (next = sym->tags.next; next != &sym->tags; next = next->next)
-	{
-	    Tag * tag = list_entry(next, Tag, global_link);
-	    CvsFileRevision * rev = tag->rev;
+    for (i = 0; i < num_syms; i++)
+	if (!apply_symbol(&res[i]))
+	    break;
 
-	    /* FIXME:test for rev->post_psm from DEBIAN. not sure how this could happen */
-	    if (!rev->present || !rev->post_psm)
-	    {
-		struct list_link *tmp = next->prev;
-		debug(DEBUG_APPERROR, "revision %s of file %s is tagged but not present",
-		      rev->rev, rev->file->filename);
-		/* FIXME: memleak */
-		list_del(next);
-		next = tmp;
-		continue;
-	    }
+    for (i = 0; i < num_syms; i++)
+	free(res[i].changes);
+    free(res);
+}
 
-	    if (!ps || rev->post_psm->ps->psid > ps->psid)
-		ps = rev->post_psm->ps;
-	}
-	
-	sym->ps = ps;
+/* run by the work pool, so must not change anything but res[item] */
+static void resolve_symbol(int item, void * arg)
+{
+    SymbolResolution * res = (SymbolResolution *)arg + item;
+    GlobalSymbol * sym = res->sym;
+    PatchSet * ps = NULL;
+    struct list_link * next;
+
+    /*
+     * First pass, determine the most recent PatchSet with a 
+     * revision tagged with the symbolic tag.  This is 'the'
+     * patchset with the tag
+     */
 
-	if (!ps)
+    for (next = sym->tags.next; next != &sym->tags; next = next->next)
+    {
+	Tag * tag = list_entry(next, Tag, global_link);
+	CvsFileRevision * rev = tag->rev;
+
+	/* FIXME:test for rev->post_psm from DEBIAN. not sure how this could happen */
+	if (!rev->present || !rev->post_psm)
 	{
-	    debug(DEBUG_APPERROR, "no patchset for tag %s", sym->tag);
-	    return;
+	    add_symbol_change(res, SC_NOT_PRESENT, tag, rev, NULL, NULL, 0);
+	    continue;
 	}
 
-	sym->flags = 0;
-	list_add(&sym->link, &ps->tags);
+	if (!ps || rev->post_psm->ps->psid > ps->psid)
+	    ps = rev->post_psm->ps;
+    }
+
+    res->ps = ps;
+
+    if (!ps)
+	return;
+
+    /* 
+     * Second pass. 
+     * check if this is an invalid patchset, 
+     * check which members are invalid.  determine
+     * the funk factor etc.
+     */
+    for (next = sym->tags.next; next != &sym->tags; next = next->next)
+    {
+	Tag * tag = list_entry(next, Tag, global_link);
+	CvsFileRevision * rev = tag->rev;
+	CvsFileRevision * next_rev;
+
+	/* dropped by the first pass */
+	if (!rev->present || !rev->post_psm)
+	    continue;
 
-	/* check if this ps is one of the '-r' patchsets */
-	if (restrict_tag_start && strcmp(restrict_tag_start, sym->tag) == 0)
-	    restrict_tag_ps_start = ps->psid;
+	if (!(next_rev = rev_follow_branch(rev, ps->branch)))
+	    continue;
 
-	/* the second -r implies -b */
-	if (restrict_tag_end && strcmp(restrict_tag_end, sym->tag) == 0)
+	/*
+	 * we want the 'tagged revision' to be valid until after
+	 * the date of the 'tagged patchset' or else there's something
+	 * funky going on
+	 */
+	if (next_rev->post_psm->ps->psid <= ps->psid)
 	{
-	    restrict_tag_ps_end = ps->psid;
+	    int flag = TAG_FUNKY;
+	    if (check_tag_funk(res, ps, next_rev))
+		flag = TAG_INVALID;
+	    add_symbol_change(res, SC_VIOLATION, tag, rev, NULL, NULL, flag);
+	}
+    }
+}
 
-	    if (restrict_branch)
-	    {
-		if (!ps->branch || strcmp(ps->branch->tag, restrict_branch) != 0)
-		{
-		    debug(DEBUG_APPMSG1, 
-			  "WARNING: -b option and second -r have conflicting branches: %s %s", 
-			  restrict_branch, PS_BRANCH(ps));
-		}
-	    }
-	    else if (ps->branch)
+/*
+ * Make the changes resolve_symbol() found.  Returns 0 if the symbol has
+ * no patch set, which stops the resolution of the remaining symbols.
+ */
+static int apply_symbol(SymbolResolution * res)
+{
+    GlobalSymbol * sym = res->sym;
+    PatchSet * ps = res->ps;
+    int i;
+
+    trace(TRACE_SYMBOL, "resolving global symbol %s", sym->tag);
+
+    for (i = 0; i < res->num_changes && res->changes[i].type == SC_NOT_PRESENT; i++)
+    {
+	SymbolChange * change = &res->changes[i];
+
+	debug(DEBUG_APPERROR, "revision %s of file %s is tagged but not present",
+	      change->rev->rev, change->rev->file->filename);
+	/* FIXME: memleak */
+	list_del(&change->tag->global_link);
+    }
+
+    sym->ps = ps;
+
+    if (!ps)
+    {
+	debug(DEBUG_APPERROR, "no patchset for tag %s", sym->tag);
+	return 0;
+    }
+
+    sym->flags = 0;
+    list_add(&sym->link, &ps->tags);
+
+    /* check if this ps is one of the '-r' patchsets */
+    if (restrict_tag_start && strcmp(restrict_tag_start, sym->tag) == 0)
+	restrict_tag_ps_start = ps->psid;
+
+    /* the second -r implies -b */
+    if (restrict_tag_end && strcmp(restrict_tag_end, sym->tag) == 0)
+    {
+	restrict_tag_ps_end = ps->psid;
+
+	if (restrict_branch)
+	{
+	    if (!ps->branch || strcmp(ps->branch->tag, restrict_branch) != 0)
 	    {
-		debug(DEBUG_APPMSG1, "NOTICE: implicit branch restriction set to %s", ps->branch->tag);
-		restrict_branch = ps->branch->tag;
+		debug(DEBUG_APPMSG1, 
+		      "WARNING: -b option and second -r have conflicting branches: %s %s", 
+		      restrict_branch, PS_BRANCH(ps));
 	    }
 	}
-
-	/* 
-	 * Second pass. 
-	 * check if this is an invalid patchset, 
-	 * check which members are invalid.  determine
-	 * the funk factor etc.
-	 */
-	for (next = sym->tags.next; next != &sym->tags; next = next->next)
+	else if (ps->branch)
 	{
-	    Tag * tag = list_entry(next, Tag, global_link);
-	    CvsFileRevision * rev = tag->rev;
-	    CvsFileRevision * next_rev = rev_follow_branch(rev, ps->branch);
+	    debug(DEBUG_APPMSG1, "NOTICE: implicit branch restriction set to %s", ps->branch->tag);
+	    restrict_branch = ps->branch->tag;
+	}
+    }
 
-	    if (!next_rev)
-		continue;
+    for (; i < res->num_changes; i++)
+    {
+	SymbolChange * change = &res->changes[i];
+	PatchSet * next_ps = change->ps;
+	CvsFileRevision * rev = change->rev;
+
+	switch (change->type)
+	{
+	case SC_FUNK_STEP:
+	    debug(DEBUG_STATUS, "ps->date %d next_ps->date %d rev->rev %s rev->branch %s", 
+		  (int)ps->date, (int)next_ps->date, rev->rev, BRANCH_NAME(rev->branch->sym));
 
 	    /*
-	     * we want the 'tagged revision' to be valid until after
-	     * the date of the 'tagged patchset' or else there's something
-	     * funky going on
+	     * If the tagname is one of the two possible '-r' tags
+	     * then the funkyness is even more important.
+	     *
+	     * In the restrict_tag_start case, this next_ps is chronologically
+	     * before ps, but tagwise after, so set the funk_factor so it will
+	     * be included.
+	     *
+	     * The restrict_tag_end case is similar, but backwards.
+	     *
+	     * Start assuming the HIDE/SHOW_ALL case, we will determine
+	     * below if we have a split ps case 
 	     */
-	    if (next_rev->post_psm->ps->psid <= ps->psid)
+	    if (restrict_tag_start && strcmp(sym->tag, restrict_tag_start) == 0)
+		next_ps->funk_factor = FNK_SHOW_ALL;
+	    if (restrict_tag_end && strcmp(sym->tag, restrict_tag_end) == 0)
+		next_ps->funk_factor = FNK_HIDE_ALL;
+	    break;
+
+	case SC_FUNK_HIT:
+	    /* only set bad_funk for one of the -r tags */
+	    if (next_ps->funk_factor)
 	    {
-		int flag = TAG_FUNKY;
-		if (check_tag_funk(ps, sym->tag, next_rev))
-		    flag = TAG_INVALID;
-		debug(DEBUG_STATUS, "file %s revision %s tag %s: TAG VIOLATION %s",
-		      rev->file->filename, rev->rev, sym->tag, tag_flag_descr[flag]);
-		sym->flags |= flag;
-		tag->flags = flag;
+		change->psm->bad_funk = 1;
+		next_ps->funk_factor = 
+		    (next_ps->funk_factor == FNK_SHOW_ALL) ? FNK_SHOW_SOME : FNK_HIDE_SOME;
 	    }
+	    debug(DEBUG_APPMSG1, 
+		  "WARNING: Invalid PatchSet %d, Tag %s:\n"
+		  "    %s:%s=after, %s:%s=before. Treated as 'before'", 
+		  next_ps->psid, sym->tag, 
+		  rev->file->filename, rev->rev, 
+		  change->psm->post_rev->file->filename, change->psm->post_rev->rev);
+	    break;
+
+	case SC_VIOLATION:
+	    debug(DEBUG_STATUS, "file %s revision %s tag %s: TAG VIOLATION %s",
+		  rev->file->filename, rev->rev, sym->tag, tag_flag_descr[change->flag]);
+	    sym->flags |= change->flag;
+	    change->tag->flags = change->flag;
+	    break;
+	}
+    }
+
+    return 1;
+}
+
+static void add_symbol_change(SymbolResolution * res, int type, Tag * tag, CvsFileRevision * rev,
+			      PatchSet * ps, PatchSetMember * psm, int flag)
+{
+    SymbolChange * change;
+
+    if (res->num_changes == res->max_changes)
+    {
+	res->max_changes = res->max_changes ? res->max_changes * 2 : 8;
+	res->changes = (SymbolChange *)realloc(res->changes, res->max_changes * sizeof(*res->changes));
+	if (!res->changes)
+	{
+	    debug(DEBUG_SYSERROR, "malloc failed for symbol changes");
+	    exit(1);
 	}
     }
+
+    change = &res->changes[res->num_changes++];
+    change->type = type;
+    change->flag = flag;
+    change->tag = tag;
+    change->rev = rev;
+    change->ps = ps;
+    change->psm = psm;
 }
 
 static void get_sym_revision(char *rev, Tag *sym)
@@ -2572,12 +3923,15 @@ static void set_psm_initial(PatchSetMember * psm)
     }
 }
 
-/* 
- * look at all revisions starting at rev and going forward until 
- * ps->date and see whether they are invalid or just funky.
+/*
+ * Count the members of patch sets on the branch of 'ps', from 'rev' up to
+ * 'ps', that are before the tag of 'res'.  Their funk is left to
+ * apply_symbol(), which gets the patch sets walked and the members found
+ * as changes.
  */
-static int check_tag_funk(PatchSet * ps, const char *tagname, CvsFileRevision * rev)
+static int check_tag_funk(SymbolResolution * res, PatchSet * ps, CvsFileRevision * rev)
 {
+    const char * tagname = res->sym->tag;
     int retval = 0;
 
     while (rev)
@@ -2588,26 +3942,7 @@ static int check_tag_funk(PatchSet * ps, const char *tagname, CvsFileRevision *
 	if (next_ps->psid > ps->psid)
 	    break;
 
-	debug(DEBUG_STATUS, "ps->date %d next_ps->date %d rev->rev %s rev->branch %s", 
-	      ps->date, next_ps->date, rev->rev, rev->branch);
-
-	/*
-	 * If the tagname is one of the two possible '-r' tags
-	 * then the funkyness is even more important.
-	 *
-	 * In the restrict_tag_start case, this next_ps is chronologically
-	 * before ps, but tagwise after, so set the funk_factor so it will
-	 * be included.
-	 *
-	 * The restrict_tag_end case is similar, but backwards.
-	 *
-	 * Start assuming the HIDE/SHOW_ALL case, we will determine
-	 * below if we have a split ps case 
-	 */
-	if (restrict_tag_start && strcmp(tagname, restrict_tag_start) == 0)
-	    next_ps->funk_factor = FNK_SHOW_ALL;
-	if (restrict_tag_end && strcmp(tagname, restrict_tag_end) == 0)
-	    next_ps->funk_factor = FNK_HIDE_ALL;
+	add_symbol_change(res, SC_FUNK_STEP, NULL, rev, next_ps, NULL, 0);
 
 	/*
 	 * if all of the other members of this patchset are also 'after' the tag
@@ -2622,19 +3957,7 @@ static int check_tag_funk(PatchSet * ps, const char *tagname, CvsFileRevision *
 	    if (revision_affects_symbol(psm->post_rev, tagname) > 0)
 	    {
 		retval ++;
-		/* only set bad_funk for one of the -r tags */
-		if (next_ps->funk_factor)
-		{
-		    psm->bad_funk = 1;
-		    next_ps->funk_factor = 
-			(next_ps->funk_factor == FNK_SHOW_ALL) ? FNK_SHOW_SOME : FNK_HIDE_SOME;
-		}
-		debug(DEBUG_APPMSG1, 
-		      "WARNING: Invalid PatchSet %d, Tag %s:\n"
-		      "    %s:%s=after, %s:%s=before. Treated as 'before'", 
-		      next_ps->psid, tagname, 
-		      rev->file->filename, rev->rev, 
-		      psm->post_rev->file->filename, psm->post_rev->rev);
+		add_symbol_change(res, SC_FUNK_HIT, NULL, rev, next_ps, psm, 0);
 	    }
 	}
 
@@ -29,5 +29,6 @@ PatchSetMember * create_patch_set_member();
 CvsFileRevision * file_get_revision(CvsFile *, const char *);
 void patch_set_add_member(PatchSet * ps, PatchSetMember * psm);
 void walk_all_patch_sets(void (*action)(PatchSet *));
+int get_revision_file(char *, CvsFile *, const char *);
 
 #endif /* CVSPS_H */
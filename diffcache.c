@@ -0,0 +1,175 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * On-disk cache of generated member diffs.  The output generated for one
+ * member of a patchset is stored gzip compressed under
+ * ~/.cvsps/diffcache/<root>#<repository>/, in a file named by a hash of
+ * the key the caller builds (filename, revisions, diff options and the
+ * method used to generate the diff), which is checked against the copy
+ * kept in <entry>.key, see cache_entry_lookup().  Diffs of historic
+ * revisions never change, so entries are never invalidated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <cbtcommon/hash.h>
+#include <cbtcommon/debug.h>
+
+#include "diffcache.h"
+#include "cvsps_types.h"
+#include "cvsps.h"
+#include "util.h"
+
+#define DIFFCACHE_DIR "diffcache"
+
+static char cache_dir[PATH_MAX];
+
+void diffcache_init()
+{
+    char root[PATH_MAX];
+    char repository[PATH_MAX];
+
+    strcpy(root, root_path);
+    strcpy(repository, repository_path);
+
+    strrep(root, '/', '#');
+    strrep(repository, '/', '#');
+
+    snprintf(cache_dir, PATH_MAX, "%s/%s", get_cvsps_dir(), DIFFCACHE_DIR);
+    if (mkdir(cache_dir, 0777) < 0 && errno != EEXIST)
+    {
+	debug(DEBUG_SYSERROR, "can't create diff cache directory %s", cache_dir);
+	exit(1);
+    }
+
+    snprintf(cache_dir, PATH_MAX, "%s/%s/%s#%s", get_cvsps_dir(), DIFFCACHE_DIR, root, repository);
+    if (mkdir(cache_dir, 0777) < 0 && errno != EEXIST)
+    {
+	debug(DEBUG_SYSERROR, "can't create diff cache directory %s", cache_dir);
+	exit(1);
+    }
+}
+
+/*
+ * Fill in 'path' with the cache location for 'key'.  Returns 1 if the
+ * diff is present, 0 if not, in which case the caller should write the
+ * uncompressed diff to 'tmp' and call diffcache_store(path, tmp).
+ * 'tmp' is unique to this process, so a background prewarm and a
+ * foreground run can fill the same entry safely.
+ */
+int diffcache_lookup(const char * key, char * path, char * tmp)
+{
+    if (cache_entry_lookup(cache_dir, key, strlen(key), ".gz", path))
+    {
+	debug(DEBUG_STATUS, "diff cache hit %s", path);
+	return 1;
+    }
+
+    /* cache_entry_lookup() leaves room for this */
+    snprintf(tmp, PATH_MAX, "%s.%d.tmp", path, (int)getpid());
+
+    debug(DEBUG_STATUS, "diff cache miss %s", path);
+    return 0;
+}
+
+/*
+ * Compress 'tmp' into the cache entry 'path'.  'tmp' is removed.
+ */
+int diffcache_store(const char * path, const char * tmp)
+{
+    char ztmp[PATH_MAX];
+    char buff[BUFSIZ];
+    FILE * fp;
+    gzFile zfp;
+    size_t len;
+    int ret = 0;
+
+    if (snprintf(ztmp, PATH_MAX, "%s.gz", tmp) >= PATH_MAX)
+    {
+	debug(DEBUG_APPERROR, "diff cache path too long for %s", tmp);
+	unlink(tmp);
+	return -1;
+    }
+
+    if (!(fp = fopen(tmp, "r")))
+    {
+	debug(DEBUG_SYSERROR, "can't open diff cache temp file %s", tmp);
+	return -1;
+    }
+
+    if (!(zfp = gzopen(ztmp, "wb")))
+    {
+	debug(DEBUG_SYSERROR, "can't open diff cache file %s", ztmp);
+	fclose(fp);
+	unlink(tmp);
+	return -1;
+    }
+
+    while ((len = fread(buff, 1, BUFSIZ, fp)) > 0)
+    {
+	if (gzwrite(zfp, buff, len) != (int)len)
+	{
+	    ret = -1;
+	    break;
+	}
+    }
+
+    if (ferror(fp))
+	ret = -1;
+
+    fclose(fp);
+    unlink(tmp);
+
+    if (gzclose(zfp) != Z_OK)
+	ret = -1;
+
+    if (ret < 0 || rename(ztmp, path) < 0)
+    {
+	debug(DEBUG_SYSERROR, "can't store diff cache entry %s", path);
+	unlink(ztmp);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the uncompressed contents of a cache entry to 'fp'
+ */
+int diffcache_print(const char * path, FILE * fp)
+{
+    char buff[BUFSIZ];
+    gzFile zfp;
+    int len;
+
+    if (!(zfp = gzopen(path, "rb")))
+    {
+	debug(DEBUG_SYSERROR, "can't open diff cache file %s", path);
+	return -1;
+    }
+
+    while ((len = gzread(zfp, buff, BUFSIZ)) > 0)
+	fwrite(buff, 1, len, fp);
+
+    gzclose(zfp);
+
+    if (len < 0)
+    {
+	debug(DEBUG_APPERROR, "corrupt diff cache file %s", path);
+	return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,14 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef DIFFCACHE_H
+#define DIFFCACHE_H
+
+void diffcache_init();
+int diffcache_lookup(const char * key, char * path, char * tmp);
+int diffcache_store(const char * path, const char * tmp);
+int diffcache_print(const char * path, FILE * fp);
+
+#endif /* DIFFCACHE_H */
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * Output of the patch sets as a git fast-import stream, in place of the
+ * text format git-cvsimport parses.  Each patch set becomes a commit on
+ * refs/heads/<branch> (HEAD is master) marked with its patch set id, with
+ * the contents of the changed files inline, executable if the checked
+ * out revision file is (see fetch_revision()).  The first commit on a
+ * branch with a known ancestor branch (-A) starts from the ancestor's
+ * last commit, as git-cvsimport does.  Tags become lightweight tags on
+ * the commit of the patch set they were resolved to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include <cbtcommon/hash.h>
+#include <cbtcommon/debug.h>
+
+#include "cvsps_types.h"
+#include "cvsps.h"
+#include "util.h"
+#include "fast_import.h"
+
+#define HEAD_BRANCH "master"
+
+/* git-cvsimport truncates log messages to this */
+#define LOG_MAX 32767
+
+/* branch name -> mark of its last commit */
+static struct hash_table * branch_marks;
+
+static void write_ident(const char *, PatchSet *);
+static void write_ref_name(const char *, const char *);
+static void write_path(const char *);
+static void write_file(CvsFile *, const char *);
+
+void fast_import_begin()
+{
+    branch_marks = create_hash_table(111);
+    printf("feature done\n");
+}
+
+void fast_import_patch_set(PatchSet * ps)
+{
+    const char * branch;
+    int * mark;
+    struct list_link * next;
+    int len;
+
+    /* patch sets cvsps could not place on a branch are dropped */
+    if (!ps->branch)
+	return;
+
+    branch = strcmp(ps->branch->tag, "HEAD") == 0 ? HEAD_BRANCH : ps->branch->tag;
+
+    printf("commit ");
+    write_ref_name("refs/heads/", branch);
+    printf("mark :%d\n", ps->psid);
+    write_ident("author", ps);
+    write_ident("committer", ps);
+
+    len = strlen(ps->descr);
+    if (len > LOG_MAX)
+	len = LOG_MAX;
+    while (len > 0 && isspace((unsigned char)ps->descr[len - 1]))
+	len--;
+
+    printf("data %d\n", len + 1);
+    fwrite(ps->descr, 1, len, stdout);
+    printf("\n");
+
+    if (!(mark = (int *)get_hash_object(branch_marks, branch)))
+    {
+	mark = (int *)malloc(sizeof(*mark));
+	if (!mark)
+	{
+	    debug(DEBUG_SYSERROR, "malloc failed for branch mark");
+	    exit(1);
+	}
+
+	put_hash_object(branch_marks, xstrdup(branch), mark);
+
+	if (ps->ancestor_branch)
+	{
+	    const char * ancestor = strcmp(ps->ancestor_branch, "HEAD") == 0 ? HEAD_BRANCH : ps->ancestor_branch;
+	    int * from = (int *)get_hash_object(branch_marks, ancestor);
+
+	    if (from && strcmp(ancestor, branch) != 0)
+		printf("from :%d\n", *from);
+	}
+    }
+
+    for (next = ps->members.next; next != &ps->members; next = next->next)
+    {
+	PatchSetMember * psm = list_entry(next, PatchSetMember, link);
+
+	if (psm->post_rev->dead)
+	{
+	    printf("D ");
+	    write_path(psm->file->filename);
+	    printf("\n");
+	}
+	else
+	{
+	    write_file(psm->file, psm->post_rev->rev);
+	}
+    }
+
+    printf("\n");
+    *mark = ps->psid;
+
+    for (next = ps->tags.next; next != &ps->tags; next = next->next)
+    {
+	GlobalSymbol * sym = list_entry(next, GlobalSymbol, link);
+
+	printf("reset ");
+	write_ref_name("refs/tags/", sym->tag);
+	printf("from :%d\n\n", ps->psid);
+    }
+}
+
+void fast_import_end()
+{
+    printf("done\n");
+    fflush(stdout);
+}
+
+/*
+ * The CVS user name is both the name and the email of the author.
+ * fast-import rejects idents with '<', '>' or a newline in them
+ */
+static void write_ident(const char * kind, PatchSet * ps)
+{
+    char author[BUFSIZ];
+    const char * p;
+    int len = 0;
+
+    for (p = ps->author; *p && len < BUFSIZ - 1; p++)
+	if (!strchr("<>\n", *p))
+	    author[len++] = *p;
+    author[len] = 0;
+
+    printf("%s %s <%s> %ld +0000\n", kind, author, author, (long)ps->date);
+}
+
+/*
+ * CVS allows characters in symbols that git does not in ref names,
+ * drop them the way git-cvsimport does
+ */
+static void write_ref_name(const char * prefix, const char * name)
+{
+    const char * p;
+
+    fputs(prefix, stdout);
+
+    for (p = name; *p; p++)
+    {
+	if (strchr(" ~^:\\*?[", *p) || iscntrl((unsigned char)*p))
+	    continue;
+	if (*p == '.' && (p == name || p[1] == '.' || p[1] == 0))
+	    continue;
+	if (*p == '-' && p == name)
+	    continue;
+	putchar(*p == '/' ? '-' : *p);
+    }
+
+    putchar('\n');
+}
+
+/* paths starting with a quote or holding a newline must be quoted */
+static void write_path(const char * path)
+{
+    const char * p;
+
+    while (*path == '/')
+	path++;
+
+    if (*path != '"' && !strchr(path, '\n'))
+    {
+	fputs(path, stdout);
+	return;
+    }
+
+    putchar('"');
+    for (p = path; *p; p++)
+    {
+	if (*p == '"' || *p == '\\')
+	    printf("\\%c", *p);
+	else if (*p == '\n')
+	    printf("\\n");
+	else
+	    putchar(*p);
+    }
+    putchar('"');
+}
+
+/* a filemodify command with the contents of file:rev inline */
+static void write_file(CvsFile * file, const char * rev)
+{
+    char path[PATH_MAX];
+    char buff[BUFSIZ];
+    struct stat sbuf;
+    size_t len;
+    int is_temp;
+    FILE * fp;
+
+    is_temp = get_revision_file(path, file, rev);
+
+    if (!(fp = fopen(path, "r")) || fstat(fileno(fp), &sbuf) < 0)
+    {
+	debug(DEBUG_SYSERROR, "can't open revision %s of %s", rev, file->filename);
+	exit(1);
+    }
+
+    printf("M %s inline ", (sbuf.st_mode & S_IXUSR) ? "100755" : "100644");
+    write_path(file->filename);
+    printf("\ndata %ld\n", (long)sbuf.st_size);
+
+    while ((len = fread(buff, 1, BUFSIZ, fp)) > 0)
+	fwrite(buff, 1, len, stdout);
+
+    printf("\n");
+    fclose(fp);
+
+    if (is_temp)
+	unlink(path);
+}
@@ -0,0 +1,13 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef FAST_IMPORT_H
+#define FAST_IMPORT_H
+
+void fast_import_begin();
+void fast_import_patch_set(PatchSet *);
+void fast_import_end();
+
+#endif /* FAST_IMPORT_H */
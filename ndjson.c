@@ -0,0 +1,227 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * Output of the patch sets as newline delimited JSON, one object per
+ * line, for consumers that would rather not parse the text format.  The
+ * first line identifies the format:
+ *
+ *   {"format":"cvsps-ndjson","version":1}
+ *
+ * Strings (authors, branches, tags, file names and logs) are written
+ * once, in a string line defining their id ahead of the first record
+ * using them, and are referred to by id after that:
+ *
+ *   {"str":<id>,"v":"<string>"}
+ *
+ * Each patch set is then one line:
+ *
+ *   {"ps":<psid>,"date":<seconds since the epoch>,"author":<id>,
+ *    "branch":<id>,"ancestor":<id>,"funk":<funk factor>,
+ *    "tags":[[<id>,<flags>],...],"log":<id>,
+ *    "members":[[<file id>,"<pre rev>","<post rev>",<dead>],...]}
+ *
+ * where "ancestor" and "funk" are left out when there are none, the tag
+ * flags are the TAG_FUNKY and TAG_INVALID bits, and the pre revision is
+ * null for a file's initial revision.  Bytes that are not valid UTF-8
+ * are taken to be Latin-1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cbtcommon/hash.h>
+#include <cbtcommon/debug.h>
+
+#include "cvsps_types.h"
+#include "cvsps.h"
+#include "ndjson.h"
+
+#define NO_BRANCH "#CVSPS_NO_BRANCH"
+
+/* string -> its id */
+static struct hash_table * string_ids;
+static int num_strings;
+
+static int string_id(const char *);
+static void write_string(const char *);
+static int utf8_length(const unsigned char *);
+
+void ndjson_begin()
+{
+    string_ids = create_hash_table(1023);
+    printf("{\"format\":\"cvsps-ndjson\",\"version\":1}\n");
+}
+
+void ndjson_patch_set(PatchSet * ps)
+{
+    const char * branch = ps->branch ? ps->branch->tag : NO_BRANCH;
+    struct list_link * next;
+    int author, branch_id, ancestor = 0, log;
+
+    /* define the strings first, so the record can refer to them */
+    author = string_id(ps->author);
+    branch_id = string_id(branch);
+    if (ps->ancestor_branch)
+	ancestor = string_id(ps->ancestor_branch);
+    log = string_id(ps->descr);
+
+    for (next = ps->tags.next; next != &ps->tags; next = next->next)
+	string_id(list_entry(next, GlobalSymbol, link)->tag);
+
+    for (next = ps->members.next; next != &ps->members; next = next->next)
+	string_id(list_entry(next, PatchSetMember, link)->file->filename);
+
+    printf("{\"ps\":%d,\"date\":%ld,\"author\":%d,\"branch\":%d",
+	   ps->psid, (long)ps->date, author, branch_id);
+    if (ancestor)
+	printf(",\"ancestor\":%d", ancestor);
+    if (ps->funk_factor)
+	printf(",\"funk\":%d", ps->funk_factor);
+
+    printf(",\"tags\":[");
+    for (next = ps->tags.next; next != &ps->tags; next = next->next)
+    {
+	GlobalSymbol * sym = list_entry(next, GlobalSymbol, link);
+
+	printf("%s[%d,%d]", next == ps->tags.next ? "" : ",", string_id(sym->tag), sym->flags);
+    }
+
+    printf("],\"log\":%d,\"members\":[", log);
+    for (next = ps->members.next; next != &ps->members; next = next->next)
+    {
+	PatchSetMember * psm = list_entry(next, PatchSetMember, link);
+
+	printf("%s[%d,", next == ps->members.next ? "" : ",", string_id(psm->file->filename));
+	if (psm->pre_rev)
+	    write_string(psm->pre_rev->rev);
+	else
+	    printf("null");
+	putchar(',');
+	write_string(psm->post_rev->rev);
+	printf(",%d]", psm->post_rev->dead ? 1 : 0);
+    }
+
+    printf("]}\n");
+}
+
+void ndjson_end()
+{
+    fflush(stdout);
+}
+
+/*
+ * The id of 's', writing its definition the first time it is seen.  The
+ * strings all live as long as the patch sets do, so are not copied.
+ */
+static int string_id(const char * s)
+{
+    int * id;
+
+    if ((id = (int *)get_hash_object(string_ids, s)))
+	return *id;
+
+    id = (int *)malloc(sizeof(*id));
+    if (!id)
+    {
+	debug(DEBUG_SYSERROR, "malloc failed for string id");
+	exit(1);
+    }
+
+    *id = ++num_strings;
+    put_hash_object(string_ids, s, id);
+
+    printf("{\"str\":%d,\"v\":", *id);
+    write_string(s);
+    printf("}\n");
+
+    return *id;
+}
+
+static void write_string(const char * s)
+{
+    const unsigned char * p = (const unsigned char *)s;
+
+    putchar('"');
+    while (*p)
+    {
+	int len;
+
+	if (*p == '"' || *p == '\\')
+	{
+	    printf("\\%c", *p++);
+	}
+	else if (*p == '\n')
+	{
+	    printf("\\n");
+	    p++;
+	}
+	else if (*p == '\t')
+	{
+	    printf("\\t");
+	    p++;
+	}
+	else if (*p < 0x20 || *p == 0x7f)
+	{
+	    printf("\\u%04x", *p++);
+	}
+	else if (*p < 0x80)
+	{
+	    putchar(*p++);
+	}
+	else if ((len = utf8_length(p)))
+	{
+	    fwrite(p, 1, len, stdout);
+	    p += len;
+	}
+	else
+	{
+	    printf("\\u%04x", *p++);
+	}
+    }
+    putchar('"');
+}
+
+/* the length of the UTF-8 sequence at 'p', or 0 if it isn't one */
+static int utf8_length(const unsigned char * p)
+{
+    unsigned int c;
+    int len, i;
+
+    if (p[0] >= 0xc2 && p[0] <= 0xdf)
+    {
+	len = 2;
+	c = p[0] & 0x1f;
+    }
+    else if (p[0] >= 0xe0 && p[0] <= 0xef)
+    {
+	len = 3;
+	c = p[0] & 0x0f;
+    }
+    else if (p[0] >= 0xf0 && p[0] <= 0xf4)
+    {
+	len = 4;
+	c = p[0] & 0x07;
+    }
+    else
+    {
+	return 0;
+    }
+
+    for (i = 1; i < len; i++)
+    {
+	if ((p[i] & 0xc0) != 0x80)
+	    return 0;
+	c = (c << 6) | (p[i] & 0x3f);
+    }
+
+    /* overlong forms, surrogates and values past U+10FFFF */
+    if ((len == 3 && c < 0x800) || (len == 4 && (c < 0x10000 || c > 0x10ffff)) ||
+	(c >= 0xd800 && c <= 0xdfff))
+	return 0;
+
+    return len;
+}
@@ -0,0 +1,13 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef NDJSON_H
+#define NDJSON_H
+
+void ndjson_begin();
+void ndjson_patch_set(PatchSet *);
+void ndjson_end();
+
+#endif /* NDJSON_H */
@@ -0,0 +1,261 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * Per-phase profile of a run.  Each phase records wall time, CPU time,
+ * growth of the peak resident set size and the change in the number and
+ * size of live objects of each type while it ran.  Phases may nest
+ * (diffing happens while printing), and a phase entered more than once
+ * is accumulated under its name.  The report is written as JSON by
+ * profile_write() when the process exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <cbtcommon/hash.h>
+#include <cbtcommon/debug.h>
+
+#include "profile.h"
+#include "util.h"
+
+#define PROFILE_MAX_PHASES 32
+#define PROFILE_MAX_DEPTH 8
+
+struct sample
+{
+    long long wall_usec;
+    long long cpu_usec;
+    long maxrss_kb;
+    struct profile_objects objects[PROF_NUM_OBJECTS];
+};
+
+struct phase
+{
+    const char * name;
+    int calls;
+    int depth;
+    struct sample total;
+};
+
+static const char * object_names[PROF_NUM_OBJECTS] = 
+{ 
+    "files", "revisions", "tags", "symbols", "patch_sets", "patch_set_members",
+    "log_text", "hash_entries", "strings"
+};
+
+struct profile_objects profile_objects[PROF_NUM_OBJECTS];
+
+static const char * profile_file;
+static pid_t profile_pid;
+static struct sample start;
+
+static struct phase phases[PROFILE_MAX_PHASES];
+static int num_phases;
+
+/* the phases in progress, and the sample taken when each was entered */
+static struct phase * stack[PROFILE_MAX_DEPTH];
+static struct sample stack_start[PROFILE_MAX_DEPTH];
+static int depth;
+
+/* begins not pushed on the stack, whose ends must not pop it either */
+static int skipped;
+
+static void profile_write();
+
+static void take_sample(struct sample * s)
+{
+    struct timeval tv;
+    struct rusage ru;
+
+    gettimeofday(&tv, NULL);
+    getrusage(RUSAGE_SELF, &ru);
+
+    s->wall_usec = (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+    s->cpu_usec = (long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + 
+	ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+    s->maxrss_kb = ru.ru_maxrss;
+    profile_get_objects(s->objects);
+}
+
+void profile_get_objects(struct profile_objects * objects)
+{
+    memcpy(objects, profile_objects, sizeof(profile_objects));
+    get_hash_stats(&objects[PROF_HASH_ENTRY].count, &objects[PROF_HASH_ENTRY].bytes);
+    get_string_stats(&objects[PROF_STRING].count, &objects[PROF_STRING].bytes);
+}
+
+/*
+ * Memory used by each type of object, for -t
+ */
+void profile_print_objects(FILE * fp)
+{
+    struct profile_objects objects[PROF_NUM_OBJECTS];
+    long count = 0, bytes = 0;
+    int i;
+
+    profile_get_objects(objects);
+
+    fprintf(fp, "Memory by object type:\n");
+    for (i = 0; i < PROF_NUM_OBJECTS; i++)
+    {
+	fprintf(fp, "  %-18s %10ld objects %12ld bytes\n", object_names[i], objects[i].count, objects[i].bytes);
+	count += objects[i].count;
+	bytes += objects[i].bytes;
+    }
+    fprintf(fp, "  %-18s %10ld objects %12ld bytes\n", "total", count, bytes);
+}
+
+void profile_init(const char * file)
+{
+    profile_file = file;
+    profile_pid = getpid();
+    take_sample(&start);
+
+    /* so that runs which fail part way are reported as well */
+    atexit(profile_write);
+}
+
+void profile_begin(const char * name)
+{
+    struct phase * ph;
+    int i;
+
+    if (!profile_file)
+	return;
+
+    /* phases inside a skipped one are skipped too, to keep the ends paired */
+    if (skipped)
+    {
+	skipped++;
+	return;
+    }
+
+    if (depth == PROFILE_MAX_DEPTH)
+    {
+	debug(DEBUG_APPERROR, "profile: phases nested too deep at %s", name);
+	skipped++;
+	return;
+    }
+
+    for (i = 0; i < num_phases; i++)
+	if (strcmp(phases[i].name, name) == 0)
+	    break;
+
+    if (i == num_phases)
+    {
+	if (num_phases == PROFILE_MAX_PHASES)
+	{
+	    debug(DEBUG_APPERROR, "profile: too many phases at %s", name);
+	    skipped++;
+	    return;
+	}
+
+	phases[num_phases].name = name;
+	phases[num_phases].depth = depth;
+	num_phases++;
+    }
+
+    ph = &phases[i];
+    ph->calls++;
+
+    stack[depth] = ph;
+    take_sample(&stack_start[depth]);
+    depth++;
+}
+
+void profile_end()
+{
+    struct sample now, * s;
+    struct phase * ph;
+    int i;
+
+    if (!profile_file)
+	return;
+
+    if (skipped)
+    {
+	skipped--;
+	return;
+    }
+
+    if (depth == 0)
+	return;
+
+    take_sample(&now);
+
+    depth--;
+    ph = stack[depth];
+    s = &stack_start[depth];
+
+    ph->total.wall_usec += now.wall_usec - s->wall_usec;
+    ph->total.cpu_usec += now.cpu_usec - s->cpu_usec;
+    ph->total.maxrss_kb += now.maxrss_kb - s->maxrss_kb;
+    for (i = 0; i < PROF_NUM_OBJECTS; i++)
+    {
+	ph->total.objects[i].count += now.objects[i].count - s->objects[i].count;
+	ph->total.objects[i].bytes += now.objects[i].bytes - s->objects[i].bytes;
+    }
+}
+
+static void write_sample(FILE * fp, struct sample * s)
+{
+    int i;
+
+    fprintf(fp, "\"wall_usec\": %lld, \"cpu_usec\": %lld, \"maxrss_delta_kb\": %ld, \"objects\": {",
+	    s->wall_usec, s->cpu_usec, s->maxrss_kb);
+
+    for (i = 0; i < PROF_NUM_OBJECTS; i++)
+	fprintf(fp, "%s\"%s\": [%ld, %ld]", i ? ", " : " ", object_names[i], s->objects[i].count, s->objects[i].bytes);
+
+    fprintf(fp, " }");
+}
+
+static void profile_write()
+{
+    struct sample now;
+    long peak_kb;
+    FILE * fp;
+    int i;
+
+    /* forked children exit through here too, the report is the parent's */
+    if (!profile_file || getpid() != profile_pid)
+	return;
+
+    /* phases left open by an exit(1) are closed here */
+    while (depth > 0)
+	profile_end();
+
+    take_sample(&now);
+    peak_kb = now.maxrss_kb;
+    now.wall_usec -= start.wall_usec;
+    now.cpu_usec -= start.cpu_usec;
+    now.maxrss_kb -= start.maxrss_kb;
+
+    if (!(fp = fopen(profile_file, "w")))
+    {
+	debug(DEBUG_SYSERROR, "can't open profile report %s", profile_file);
+	return;
+    }
+
+    fprintf(fp, "{\n  \"phases\": [\n");
+
+    for (i = 0; i < num_phases; i++)
+    {
+	fprintf(fp, "    { \"name\": \"%s\", \"depth\": %d, \"calls\": %d, ", phases[i].name, phases[i].depth, phases[i].calls);
+	write_sample(fp, &phases[i].total);
+	fprintf(fp, " }%s\n", (i < num_phases - 1) ? "," : "");
+    }
+
+    fprintf(fp, "  ],\n  \"total\": { ");
+    write_sample(fp, &now);
+    fprintf(fp, " },\n  \"peak_rss_kb\": %ld\n}\n", peak_kb);
+
+    fclose(fp);
+}
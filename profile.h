@@ -0,0 +1,47 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+enum
+{
+    PROF_FILE,
+    PROF_REVISION,
+    PROF_TAG,
+    PROF_SYMBOL,
+    PROF_PATCH_SET,
+    PROF_MEMBER,
+    PROF_LOG,
+    PROF_HASH_ENTRY,
+    PROF_STRING,
+    PROF_NUM_OBJECTS
+};
+
+struct profile_objects
+{
+    long count;
+    long bytes;
+};
+
+/* 
+ * live objects of each type and the bytes they use.  hash entries and
+ * interned strings are accounted by their own modules;  the hash bytes
+ * include the bucket arrays of the tables
+ */
+extern struct profile_objects profile_objects[PROF_NUM_OBJECTS];
+
+#define profile_alloc(type, size) (profile_objects[type].count++, profile_objects[type].bytes += (size))
+#define profile_free(type, size) (profile_objects[type].count--, profile_objects[type].bytes -= (size))
+#define profile_bytes(type, size) (profile_objects[type].bytes += (size))
+
+void profile_get_objects(struct profile_objects *);
+void profile_print_objects(FILE *);
+
+void profile_init(const char * file);
+void profile_begin(const char * phase);
+void profile_end();
+
+#endif /* PROFILE_H */
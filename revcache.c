@@ -0,0 +1,336 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * On-disk cache of file revision contents.  Each revision fetched with
+ * 'co -p' is stored under ~/.cvsps/revcache/<root>#<repository>/ in a
+ * file named by a hash of (filename, revision), so diffs between two
+ * cached revisions can be produced locally without asking the server.
+ * The entries are handed to diff as they are, so (filename, revision)
+ * is kept next to each one in <entry>.key, see cache_entry_lookup().
+ *
+ * The cache is bounded by a size cap.  Entries are touched on every hit
+ * and the least recently used entries are removed when the cap is
+ * exceeded.  Entries in use can be pinned to keep them from being
+ * removed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <cbtcommon/hash.h>
+#include <cbtcommon/debug.h>
+
+#include "revcache.h"
+#include "cvsps_types.h"
+#include "cvsps.h"
+#include "util.h"
+
+#define REVCACHE_DIR "revcache"
+
+/* evict down to this percentage of the cap so eviction scans are amortized */
+#define REVCACHE_LOW_WATER 90
+
+/* entries the caller can pin at once */
+#define REVCACHE_PINS 4
+
+/* temporary files older than this are left over whoever wrote them */
+#define REVCACHE_TMP_MAX_AGE 3600
+
+struct cache_entry
+{
+    time_t mtime;
+    off_t size;
+    char * path;
+};
+
+static char cache_dir[PATH_MAX];
+static long long cache_max;
+static long long cache_size;
+
+/* the directory walk API pretty much requires use of globals :-( */
+static struct cache_entry * entries;
+static int num_entries;
+static int max_entries;
+
+static char pins[REVCACHE_PINS][PATH_MAX];
+static int num_pins;
+
+static int is_pinned(const char *);
+static int is_stale_tmp(const char *, struct stat *);
+static void walk_cache(void (*action)(const char *, struct stat *));
+static void count_entry(const char *, struct stat *);
+static void collect_entry(const char *, struct stat *);
+static void evict(const char *);
+
+void revcache_init(long max_kbytes)
+{
+    char root[PATH_MAX];
+    char repository[PATH_MAX];
+
+    strcpy(root, root_path);
+    strcpy(repository, repository_path);
+
+    strrep(root, '/', '#');
+    strrep(repository, '/', '#');
+
+    snprintf(cache_dir, PATH_MAX, "%s/%s", get_cvsps_dir(), REVCACHE_DIR);
+    if (mkdir(cache_dir, 0777) < 0 && errno != EEXIST)
+    {
+	debug(DEBUG_SYSERROR, "can't create revision cache directory %s", cache_dir);
+	exit(1);
+    }
+
+    snprintf(cache_dir, PATH_MAX, "%s/%s/%s#%s", get_cvsps_dir(), REVCACHE_DIR, root, repository);
+    if (mkdir(cache_dir, 0777) < 0 && errno != EEXIST)
+    {
+	debug(DEBUG_SYSERROR, "can't create revision cache directory %s", cache_dir);
+	exit(1);
+    }
+
+    cache_max = (long long)max_kbytes * 1024;
+    cache_size = 0;
+    walk_cache(count_entry);
+
+    debug(DEBUG_STATUS, "revision cache %s: %lld bytes used, %lld max", cache_dir, cache_size, cache_max);
+}
+
+/*
+ * Fill in 'path' with the cache location for file:rev.  Returns 1 if
+ * the revision is present (and marks it recently used), 0 if not, in
+ * which case the caller should write the contents to 'tmp' and call
+ * revcache_store(path, tmp).  'tmp' is unique to this process, so a
+ * background prewarm and a foreground run can fill the same entry.
+ */
+int revcache_lookup(const char * file, const char * rev, char * path, char * tmp)
+{
+    char key[CACHE_KEY_MAX];
+    int keylen;
+
+    /* the key is "file\0rev" */
+    keylen = snprintf(key, sizeof(key), "%s%c%s", file, 0, rev);
+    if (keylen >= (int)sizeof(key))
+    {
+	debug(DEBUG_APPERROR, "revision cache key too long for %s:%s", file, rev);
+	exit(1);
+    }
+
+    if (cache_entry_lookup(cache_dir, key, keylen, "", path))
+    {
+	utime(path, NULL);
+	debug(DEBUG_STATUS, "revision cache hit %s:%s", file, rev);
+	return 1;
+    }
+
+    /* cache_entry_lookup() leaves room for this */
+    snprintf(tmp, PATH_MAX, "%s.%d.tmp", path, (int)getpid());
+
+    debug(DEBUG_STATUS, "revision cache miss %s:%s", file, rev);
+    return 0;
+}
+
+int revcache_store(const char * path, const char * tmp)
+{
+    struct stat sbuf, old;
+
+    /* another process may have stored the entry meanwhile */
+    if (stat(path, &old) < 0)
+	old.st_size = 0;
+
+    if (stat(tmp, &sbuf) < 0 || rename(tmp, path) < 0)
+    {
+	debug(DEBUG_SYSERROR, "can't store revision cache entry %s", path);
+	unlink(tmp);
+	return -1;
+    }
+
+    cache_size += sbuf.st_size - old.st_size;
+
+    if (cache_max > 0 && cache_size > cache_max)
+	evict(path);
+
+    return 0;
+}
+
+/*
+ * Keep the entry at 'path' from being evicted until revcache_unpin(),
+ * e.g. the first side of a diff while the second is fetched
+ */
+void revcache_pin(const char * path)
+{
+    if (num_pins == REVCACHE_PINS)
+    {
+	debug(DEBUG_APPERROR, "too many pinned revision cache entries");
+	exit(1);
+    }
+
+    strcpy(pins[num_pins++], path);
+}
+
+void revcache_unpin()
+{
+    num_pins = 0;
+}
+
+static int is_pinned(const char * path)
+{
+    int i;
+
+    for (i = 0; i < num_pins; i++)
+	if (strcmp(pins[i], path) == 0)
+	    return 1;
+
+    return 0;
+}
+
+static void walk_cache(void (*action)(const char *, struct stat *))
+{
+    DIR * top, * sub;
+    struct dirent * de, * se;
+    char subdir[PATH_MAX];
+    char path[PATH_MAX];
+    struct stat sbuf;
+
+    if (!(top = opendir(cache_dir)))
+	return;
+
+    while ((de = readdir(top)))
+    {
+	if (de->d_name[0] == '.')
+	    continue;
+
+	if (snprintf(subdir, PATH_MAX, "%s/%s", cache_dir, de->d_name) >= PATH_MAX ||
+	    !(sub = opendir(subdir)))
+	    continue;
+
+	while ((se = readdir(sub)))
+	{
+	    int len = strlen(se->d_name);
+
+	    if (se->d_name[0] == '.')
+		continue;
+
+	    if (snprintf(path, PATH_MAX, "%s/%s", subdir, se->d_name) >= PATH_MAX)
+		continue;
+
+	    /* fetches in progress, or partial ones from an interrupted run */
+	    if (len > 4 && strcmp(se->d_name + len - 4, ".tmp") == 0)
+	    {
+		if (stat(path, &sbuf) == 0 && is_stale_tmp(se->d_name, &sbuf))
+		    unlink(path);
+		continue;
+	    }
+
+	    /* the keys go with their entries */
+	    if (len > 4 && strcmp(se->d_name + len - 4, ".key") == 0)
+		continue;
+
+	    if (stat(path, &sbuf) == 0 && S_ISREG(sbuf.st_mode))
+		action(path, &sbuf);
+	}
+
+	closedir(sub);
+    }
+
+    closedir(top);
+}
+
+/*
+ * Temporary files are named <entry>.<pid>.tmp (and <entry>.key.<pid>.tmp).
+ * One is only removed if the process writing it is gone, or if it is too
+ * old to still be written, in case the pid was reused.
+ */
+static int is_stale_tmp(const char * name, struct stat * sbuf)
+{
+    const char * p = name + strlen(name) - 4;
+    pid_t pid;
+
+    if (time(NULL) - sbuf->st_mtime > REVCACHE_TMP_MAX_AGE)
+	return 1;
+
+    while (p > name && p[-1] >= '0' && p[-1] <= '9')
+	p--;
+
+    if (p == name || p[-1] != '.' || (pid = atoi(p)) <= 0)
+	return 0;
+
+    return (kill(pid, 0) < 0 && errno == ESRCH);
+}
+
+static void count_entry(const char * path, struct stat * sbuf)
+{
+    cache_size += sbuf->st_size;
+}
+
+static void collect_entry(const char * path, struct stat * sbuf)
+{
+    if (num_entries == max_entries)
+    {
+	max_entries = max_entries ? max_entries * 2 : 1024;
+	entries = (struct cache_entry *)realloc(entries, max_entries * sizeof(*entries));
+	if (!entries)
+	{
+	    debug(DEBUG_SYSERROR, "malloc failed for revision cache eviction");
+	    exit(1);
+	}
+    }
+
+    entries[num_entries].mtime = sbuf->st_mtime;
+    entries[num_entries].size = sbuf->st_size;
+    entries[num_entries].path = xstrdup(path);
+    num_entries++;
+}
+
+static int compare_entries(const void * v1, const void * v2)
+{
+    const struct cache_entry * e1 = (const struct cache_entry *)v1;
+    const struct cache_entry * e2 = (const struct cache_entry *)v2;
+
+    return (e1->mtime < e2->mtime) ? -1 : ((e1->mtime > e2->mtime) ? 1 : 0);
+}
+
+/*
+ * Remove least recently used entries until the cache is below the low
+ * water mark.  'keep' is the entry just stored, which the caller is
+ * about to use, so it is never removed, and neither are pinned entries.
+ */
+static void evict(const char * keep)
+{
+    long long low_water = cache_max / 100 * REVCACHE_LOW_WATER;
+    int i;
+
+    num_entries = 0;
+    walk_cache(collect_entry);
+    qsort(entries, num_entries, sizeof(*entries), compare_entries);
+
+    cache_size = 0;
+    for (i = 0; i < num_entries; i++)
+	cache_size += entries[i].size;
+
+    for (i = 0; i < num_entries && cache_size > low_water; i++)
+    {
+	if (strcmp(entries[i].path, keep) == 0 || is_pinned(entries[i].path))
+	    continue;
+
+	if (cache_entry_remove(entries[i].path) == 0)
+	{
+	    debug(DEBUG_STATUS, "revision cache evicted %s", entries[i].path);
+	    cache_size -= entries[i].size;
+	}
+    }
+
+    for (i = 0; i < num_entries; i++)
+	free(entries[i].path);
+}
@@ -0,0 +1,15 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef REVCACHE_H
+#define REVCACHE_H
+
+void revcache_init(long max_kbytes);
+int revcache_lookup(const char * file, const char * rev, char * path, char * tmp);
+int revcache_store(const char * path, const char * tmp);
+void revcache_pin(const char * path);
+void revcache_unpin();
+
+#endif /* REVCACHE_H */
@@ -10,6 +10,7 @@
 
 #include "cvsps_types.h"
 #include "cvsps.h"
+#include "profile.h"
 
 static unsigned int num_patch_sets = 0;
 static unsigned int num_ps_member = 0, max_ps_member_in_ps = 0;
@@ -132,5 +133,7 @@ void print_statistics(void * ps_tree)
 	    num_authors, max_author_len, (float)total_author_len/num_authors);
     printf("Max desc len: %d, Avg. desc len: %.2f\n",
 	    max_descr_len, (float)total_descr_len/num_patch_sets);
+
+    profile_print_objects(stdout);
 }
 
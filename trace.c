@@ -0,0 +1,380 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <cbtcommon/debug.h>
+
+#include "trace.h"
+
+#ifdef CVSPS_TRACE
+
+#ifdef CVSPS_TRACE_RING
+
+#define TRACE_ARGS_MAX 6
+#define TRACE_STR_MAX 160
+
+struct trace_arg
+{
+    char type;	/* 'i', 'l', 'p' or 's' */
+    union
+    {
+	int i;
+	long l;
+	void * p;
+	int str;	/* offset in trace_rec.strs */
+    } u;
+};
+
+struct trace_rec
+{
+    unsigned long seq;
+    unsigned int category;
+    const char * fmt;
+    int nargs;
+    struct trace_arg args[TRACE_ARGS_MAX];
+    char strs[TRACE_STR_MAX];
+};
+
+static struct trace_rec ring[CVSPS_TRACE_RING];
+static unsigned long num_events;
+
+/*
+ * Find the next conversion in 'fmt'.  Returns a pointer to it (the '%')
+ * and sets *end past it and *type to the argument type it takes, or
+ * returns NULL if there is none.
+ */
+static const char * next_conversion(const char * fmt, const char ** end, char * type)
+{
+    const char * p;
+    int is_long;
+
+    while ((p = strchr(fmt, '%')))
+    {
+	const char * q = p + 1;
+
+	if (*q == '%')
+	{
+	    fmt = q + 1;
+	    continue;
+	}
+
+	while (*q && strchr("-+ #0123456789.", *q))
+	    q++;
+
+	is_long = 0;
+	while (*q == 'l' || *q == 'h' || *q == 'z')
+	    is_long |= (*q++ != 'h');
+
+	switch (*q)
+	{
+	case 's':
+	    *type = 's';
+	    break;
+	case 'p':
+	    *type = 'p';
+	    break;
+	case '\0':
+	    return NULL;
+	default:
+	    *type = is_long ? 'l' : 'i';
+	    break;
+	}
+
+	*end = q + 1;
+	return p;
+    }
+
+    return NULL;
+}
+
+static void record_event(unsigned int category, const char * fmt, va_list ap)
+{
+    struct trace_rec * rec = &ring[num_events % CVSPS_TRACE_RING];
+    const char * p = fmt;
+    const char * end;
+    char type;
+    int str_len = 0;
+
+    rec->seq = num_events++;
+    rec->category = category;
+    rec->fmt = fmt;
+    rec->nargs = 0;
+
+    while (rec->nargs < TRACE_ARGS_MAX && (p = next_conversion(p, &end, &type)))
+    {
+	struct trace_arg * arg = &rec->args[rec->nargs++];
+
+	arg->type = type;
+	switch (type)
+	{
+	case 's':
+	{
+	    const char * s = va_arg(ap, const char *);
+	    int len;
+
+	    if (!s)
+		s = "(null)";
+
+	    len = strlen(s);
+	    if (len > TRACE_STR_MAX - 1 - str_len)
+		len = TRACE_STR_MAX - 1 - str_len;
+
+	    memcpy(rec->strs + str_len, s, len);
+	    rec->strs[str_len + len] = 0;
+	    arg->u.str = str_len;
+
+	    /* once full, the remaining strings are all the final empty one */
+	    str_len += len + 1;
+	    if (str_len > TRACE_STR_MAX - 1)
+		str_len = TRACE_STR_MAX - 1;
+	    break;
+	}
+	case 'p':
+	    arg->u.p = va_arg(ap, void *);
+	    break;
+	case 'l':
+	    arg->u.l = va_arg(ap, long);
+	    break;
+	default:
+	    arg->u.i = va_arg(ap, int);
+	    break;
+	}
+
+	p = end;
+    }
+}
+
+/* append the literal text from 'p' to 'end' to 'buff', undoubling %% */
+static int append_literal(char * buff, int len, int size, const char * p, const char * end)
+{
+    while (p < end && len < size - 1)
+    {
+	if (*p == '%' && p + 1 < end && p[1] == '%')
+	    p++;
+	buff[len++] = *p++;
+    }
+
+    buff[len] = 0;
+    return len;
+}
+
+/*
+ * The saved events are formatted by hand rather than with snprintf,
+ * which is not async-signal-safe, since they are dumped from the fatal
+ * signal handler.  Only what trace formats use is supported: the '-'
+ * and '0' flags, width, precision for strings, and the d, i, u, x, X,
+ * o, c, p and s conversions.
+ */
+static int append_string(char * buff, int len, int size, const char * s, int width, int prec, int left)
+{
+    int n = 0;
+
+    while (s[n] && (prec < 0 || n < prec))
+	n++;
+
+    for (; !left && width > n && len < size - 1; width--)
+	buff[len++] = ' ';
+
+    for (; *s && n > 0 && len < size - 1; n--, width--)
+	buff[len++] = *s++;
+
+    for (; left && width > 0 && len < size - 1; width--)
+	buff[len++] = ' ';
+
+    buff[len] = 0;
+    return len;
+}
+
+static int append_number(char * buff, int len, int size, unsigned long v, int neg, int base, int upper, 
+			 int width, int zero, int left)
+{
+    const char * digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char num[3 * sizeof(long) + 2];
+    int n = sizeof(num) - 1;
+
+    num[n] = 0;
+    do
+    {
+	num[--n] = digits[v % base];
+	v /= base;
+    }
+    while (v);
+
+    if (zero && !left)
+	while (n > 1 && (int)sizeof(num) - 1 - n + neg < width)
+	    num[--n] = '0';
+
+    if (neg)
+	num[--n] = '-';
+
+    return append_string(buff, len, size, num + n, width, -1, left);
+}
+
+/* format a saved event into 'buff' */
+static void format_event(char * buff, int size, const struct trace_rec * rec)
+{
+    const char * p = rec->fmt;
+    const char * conv;
+    const char * end;
+    char type;
+    int len = 0;
+    int i;
+
+    for (i = 0; i < rec->nargs && (conv = next_conversion(p, &end, &type)); i++)
+    {
+	const struct trace_arg * arg = &rec->args[i];
+	const char * q = conv + 1;
+	int left = 0, zero = 0, width = 0, prec = -1;
+	long sv;
+
+	len = append_literal(buff, len, size, p, conv);
+
+	for (; *q && strchr("-+ #0", *q); q++)
+	{
+	    left |= (*q == '-');
+	    zero |= (*q == '0');
+	}
+
+	for (; *q >= '0' && *q <= '9'; q++)
+	    width = width * 10 + *q - '0';
+
+	if (*q == '.')
+	    for (prec = 0, q++; *q >= '0' && *q <= '9'; q++)
+		prec = prec * 10 + *q - '0';
+
+	/* the conversion character is the last of the spec */
+	switch (arg->type)
+	{
+	case 's':
+	    len = append_string(buff, len, size, rec->strs + arg->u.str, width, prec, left);
+	    break;
+	case 'p':
+	    len = append_string(buff, len, size, "0x", 0, -1, 0);
+	    len = append_number(buff, len, size, (unsigned long)arg->u.p, 0, 16, 0, width - 2, zero, left);
+	    break;
+	default:
+	    sv = (arg->type == 'l') ? arg->u.l : arg->u.i;
+
+	    switch (end[-1])
+	    {
+	    case 'x':
+	    case 'X':
+	    case 'o':
+	    case 'u':
+	    {
+		unsigned long uv = (arg->type == 'l') ? (unsigned long)arg->u.l : (unsigned int)arg->u.i;
+		int base = (end[-1] == 'u') ? 10 : (end[-1] == 'o' ? 8 : 16);
+
+		len = append_number(buff, len, size, uv, 0, base, end[-1] == 'X', width, zero, left);
+		break;
+	    }
+	    case 'c':
+	    {
+		char c[2] = { (char)sv, 0 };
+
+		len = append_string(buff, len, size, c, width, -1, left);
+		break;
+	    }
+	    default:
+		len = append_number(buff, len, size, sv < 0 ? -(unsigned long)sv : (unsigned long)sv, sv < 0, 
+				    10, 0, width, zero, left);
+		break;
+	    }
+	    break;
+	}
+
+	p = end;
+    }
+
+    len = append_literal(buff, len, size, p, p + strlen(p));
+
+    /* log lines carry their own newline */
+    while (len > 0 && buff[len - 1] == '\n')
+	buff[--len] = 0;
+}
+
+static void fatal_signal(int sig)
+{
+    char buff[128];
+    int len;
+
+    len = append_string(buff, 0, sizeof(buff), "cvsps: fatal signal ", 0, -1, 0);
+    len = append_number(buff, len, sizeof(buff), sig, 0, 10, 0, 0, 0, 0);
+    len = append_string(buff, len, sizeof(buff), ", last trace events:\n", 0, -1, 0);
+    write(2, buff, len);
+    trace_dump(2);
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+#endif /* CVSPS_TRACE_RING */
+
+void trace_init()
+{
+#ifdef CVSPS_TRACE_RING
+    signal(SIGSEGV, fatal_signal);
+    signal(SIGBUS, fatal_signal);
+    signal(SIGFPE, fatal_signal);
+    signal(SIGILL, fatal_signal);
+    signal(SIGABRT, fatal_signal);
+#endif
+}
+
+void trace_event(unsigned int category, const char * fmt, ...)
+{
+    va_list ap;
+
+#ifdef CVSPS_TRACE_RING
+    va_start(ap, fmt);
+    record_event(category, fmt, ap);
+    va_end(ap);
+#endif
+
+    if (debuglvl & DEBUG_STATUS)
+    {
+	va_start(ap, fmt);
+	vdebug(DEBUG_STATUS, fmt, ap);
+	va_end(ap);
+    }
+}
+
+/*
+ * Write the saved events, oldest first, to file descriptor 'fd'.  Called
+ * from a signal handler, so the events are formatted with the signal-safe
+ * code above into a buffer on the stack, and written with write(2).
+ */
+void trace_dump(int fd)
+{
+#ifdef CVSPS_TRACE_RING
+    unsigned long seq = (num_events > CVSPS_TRACE_RING) ? num_events - CVSPS_TRACE_RING : 0;
+    char buff[1024];
+
+    for (; seq < num_events; seq++)
+    {
+	const struct trace_rec * rec = &ring[seq % CVSPS_TRACE_RING];
+	int len;
+
+	len = append_number(buff, 0, sizeof(buff), rec->seq, 0, 10, 0, 0, 0, 0);
+	len = append_string(buff, len, sizeof(buff), " [", 0, -1, 0);
+	len = append_number(buff, len, sizeof(buff), rec->category, 0, 16, 0, 0, 0, 0);
+	len = append_string(buff, len, sizeof(buff), "] ", 0, -1, 0);
+	format_event(buff + len, sizeof(buff) - len - 1, rec);
+	len = strlen(buff);
+	buff[len++] = '\n';
+
+	if (write(fd, buff, len) < 0)
+	    break;
+    }
+#endif
+}
+
+#endif /* CVSPS_TRACE */
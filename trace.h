@@ -0,0 +1,48 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+ * Tracing of the parse hot path.  trace() calls are compiled out
+ * completely, arguments included, unless CVSPS_TRACE is defined to the
+ * mask of categories wanted, e.g. -DCVSPS_TRACE=TRACE_ALL.  Categories
+ * compiled in are printed like debug(DEBUG_STATUS, ...) with -v.
+ *
+ * If CVSPS_TRACE_RING is also defined to a number of events, the last
+ * that many events of the compiled in categories are kept in a ring
+ * buffer whether or not -v is given, with only their arguments saved,
+ * and are formatted to stderr when cvsps dies on a fatal signal.
+ * Formats may use the d, i, u, x, c, s and p conversions with an
+ * optional l; strings are copied (truncated) when the event is saved.
+ */
+
+#define TRACE_PARSE    0x1  /* lines of the rlog */
+#define TRACE_FILE     0x2  /* files, revisions and symbols */
+#define TRACE_PATCHSET 0x4  /* patch set coalescing */
+#define TRACE_SYMBOL   0x8  /* global symbol resolution */
+#define TRACE_ALL      0xf
+
+#ifdef CVSPS_TRACE
+
+#define trace(cat, ...)						\
+    do {								\
+	if ((CVSPS_TRACE) & (cat))					\
+	    trace_event((cat), __VA_ARGS__);				\
+    } while (0)
+
+void trace_init();
+void trace_event(unsigned int, const char *, ...);
+void trace_dump(int);
+
+#else
+
+#define trace(cat, ...) do { } while (0)
+#define trace_init() do { } while (0)
+
+#endif /* CVSPS_TRACE */
+
+#endif /* TRACE_H */
@@ -12,6 +12,7 @@
 #include <search.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <regex.h>
 #include <sys/stat.h>
@@ -26,6 +27,15 @@
 typedef int (*compare_func)(const void *, const void *);
 
 static void * string_tree;
+
+/* 
+ * accounting for get_string.  a tsearch node is a key pointer, two child
+ * pointers and a color bit, rounded up to the allocation granularity
+ */
+#define STRING_NODE_SIZE (4 * sizeof(void *))
+static long num_strings;
+static long string_bytes;
+
 char *readfile(char const *filename, char *buf, size_t size)
 {
     FILE *fp;
@@ -136,11 +146,21 @@ char *get_string(char const *str)
 	char *key = xstrdup(str);
 	res = (char **)tsearch(key, &string_tree, (compare_func)strcmp);
 	*res = key;
+
+	num_strings++;
+	string_bytes += strlen(key) + 1 + STRING_NODE_SIZE;
     }
 
     return *res;
 }
 
+/* number of interned strings, and bytes used including the tree */
+void get_string_stats(long *count, long *bytes)
+{
+    *count = num_strings;
+    *bytes = string_bytes;
+}
+
 static int get_int_substr(const char * str, const regmatch_t * p)
 {
     char buff[256];
@@ -149,25 +169,89 @@ static int get_int_substr(const char * str, const regmatch_t * p)
     return atoi(buff);
 }
 
-static time_t mktime_utc(struct tm * tm)
+/*
+ * Days since 1970-01-01 of a date in the proleptic Gregorian calendar,
+ * and the reverse (H. Hinnant's days_from_civil and civil_from_days).
+ * 'm' is 1..12, 'd' may run past the end of the month.
+ */
+static long days_from_civil(long y, int m, int d)
 {
-    char * old_tz = getenv("TZ");
-    time_t ret;
+    long era;
+    unsigned int yoe, doy, doe;
 
-    setenv("TZ", "UTC", 1);
+    y -= (m <= 2);
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned int)(y - era * 400);
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
 
-    tzset();
-	    
-    ret = mktime(tm);
+    return era * 146097 + (long)doe - 719468;
+}
 
-    if (old_tz)
-	setenv("TZ", old_tz, 1);
-    else 
-	unsetenv("TZ");
+static void civil_from_days(long z, int * y, int * m, int * d)
+{
+    long era;
+    unsigned int doe, yoe, doy, mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = (unsigned int)(z - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = (mp < 10) ? mp + 3 : mp - 9;
+    *y = yoe + era * 400 + (*m <= 2);
+}
 
-    tzset();
+/*
+ * What mktime() gives for these fields with TZ=UTC, out of range fields
+ * carry over the same way
+ */
+static time_t utc_from_civil(long y, int m, int d, int hh, int mm, int ss)
+{
+    /* bring the month into 1..12 */
+    m--;
+    y += (m >= 0 ? m : m - 11) / 12;
+    m = (m % 12 + 12) % 12 + 1;
 
-    return ret;
+    return (time_t)days_from_civil(y, m, d) * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+static int get_digits(const char * p, int n)
+{
+    int val = 0;
+
+    while (n--)
+    {
+	if (*p < '0' || *p > '9')
+	    return -1;
+	val = val * 10 + (*p++ - '0');
+    }
+
+    return val;
+}
+
+/*
+ * The fixed 'YYYY/MM/DD HH:MM:SS' (or 'YYYY-MM-DD ...') form at the start
+ * of 'dte', which is what rlog writes.  Returns 0 if 'dte' is not in it.
+ */
+static int parse_date_fixed(time_t * t, const char * dte)
+{
+    int y, m, d, hh, mm, ss;
+
+    if ((dte[4] != '/' && dte[4] != '-') || dte[7] != dte[4] ||
+	dte[10] != ' ' || dte[13] != ':' || dte[16] != ':')
+	return 0;
+
+    if ((y = get_digits(dte, 4)) < 0 || (m = get_digits(dte + 5, 2)) < 0 ||
+	(d = get_digits(dte + 8, 2)) < 0 || (hh = get_digits(dte + 11, 2)) < 0 ||
+	(mm = get_digits(dte + 14, 2)) < 0 || (ss = get_digits(dte + 17, 2)) < 0)
+	return 0;
+
+    *t = utc_from_civil(y, m, d, hh, mm, ss);
+    return 1;
 }
 
 void convert_date(time_t * t, const char * dte)
@@ -175,10 +259,28 @@ void convert_date(time_t * t, const char * dte)
     static regex_t date_re;
     static int init_re;
 
+    /* the last date converted, consecutive revisions often share it */
+    static char memo_dte[DATE_STR_MAX];
+    static time_t memo_t;
+
 #define MAX_MATCH 16
     size_t nmatch = MAX_MATCH;
     regmatch_t match[MAX_MATCH];
 
+    if (strncmp(dte, memo_dte, DATE_STR_MAX) == 0)
+    {
+	*t = memo_t;
+	return;
+    }
+
+    /* strnlen() keeps the fixed parser from reading past a short string */
+    if (strnlen(dte, 19) == 19 && parse_date_fixed(t, dte))
+    {
+	strncpy(memo_dte, dte, DATE_STR_MAX - 1);
+	memo_t = *t;
+	return;
+    }
+
     if (!init_re) 
     {
 	if (regcomp(&date_re, "([0-9]{4})[-/]([0-9]{2})[-/]([0-9]{2}) ([0-9]{2}):([0-9]{2}):([0-9]{2})", REG_EXTENDED)) 
@@ -192,22 +294,19 @@ void convert_date(time_t * t, const char * dte)
     if (regexec(&date_re, dte, nmatch, match, 0) == 0)
     {
 	regmatch_t * pm = match;
-	struct tm tm = {0};
+	int y, m, d, hh, mm, ss;
 
 	/* first regmatch_t is match location of entire re */
 	pm++;
 	
-	tm.tm_year = get_int_substr(dte, pm++);
-	tm.tm_mon  = get_int_substr(dte, pm++);
-	tm.tm_mday = get_int_substr(dte, pm++);
-	tm.tm_hour = get_int_substr(dte, pm++);
-	tm.tm_min  = get_int_substr(dte, pm++);
-	tm.tm_sec  = get_int_substr(dte, pm++);
-
-	tm.tm_year -= 1900;
-	tm.tm_mon--;
-
-	*t = mktime_utc(&tm);
+	y  = get_int_substr(dte, pm++);
+	m  = get_int_substr(dte, pm++);
+	d  = get_int_substr(dte, pm++);
+	hh = get_int_substr(dte, pm++);
+	mm = get_int_substr(dte, pm++);
+	ss = get_int_substr(dte, pm++);
+
+	*t = utc_from_civil(y, m, d, hh, mm, ss);
     }
     else
     {
@@ -215,6 +314,65 @@ void convert_date(time_t * t, const char * dte)
     }
 }
 
+/*
+ * Format 't' in local time as 'YYYY/MM/DD HH:MM:SS'.  Rather than calling
+ * localtime() for each date, the UTC offset found for one date is reused
+ * for the day that follows it, if the offset is the same at the end of
+ * that day (no zone changes its offset twice in a day).
+ */
+void format_date(char * buff, int len, time_t t)
+{
+    static int init_tz;
+    static time_t window_start = 1;
+    static time_t window_end;
+    static long gmtoff;
+    time_t local;
+    long days;
+    int secs;
+    int y, m, d;
+
+    if (t < window_start || t >= window_end)
+    {
+	struct tm tm;
+	time_t next = t + 86400;
+
+	if (!init_tz)
+	{
+	    tzset();
+	    init_tz = 1;
+	}
+
+	localtime_r(&next, &tm);
+	gmtoff = tm.tm_gmtoff;
+	localtime_r(&t, &tm);
+
+	if (tm.tm_gmtoff == gmtoff)
+	{
+	    window_start = t;
+	    window_end = next;
+	}
+	else
+	{
+	    window_start = 1;
+	    window_end = 0;
+	}
+
+	gmtoff = tm.tm_gmtoff;
+    }
+
+    local = t + gmtoff;
+    days = local / 86400;
+    secs = local % 86400;
+    if (secs < 0)
+    {
+	days--;
+	secs += 86400;
+    }
+
+    civil_from_days(days, &y, &m, &d);
+    snprintf(buff, len, "%d/%02d/%02d %02d:%02d:%02d", y, m, d, secs / 3600, secs / 60 % 60, secs % 60);
+}
+
 static struct timeval start_time;
 
 void timing_start()
@@ -289,3 +447,151 @@ int escape_filename(char * dst, int len, const char * src)
 
     return (*src == 0) ? 0 : -1;
 }
+
+/*
+ * Hashed entries of the on-disk caches.  An entry is stored under 'dir'
+ * as <xx>/<hash><suffix>, where <hash> is a 64 bit FNV-1a hash of the
+ * key and <xx> its top byte.  The key itself is kept next to the entry
+ * in <entry>.key and checked on lookup;  on a hash collision the next
+ * slot, <hash>-<n><suffix>, is tried.
+ */
+
+/* slots tried for a key before the last one is taken over */
+#define CACHE_PROBES 8
+
+static int cache_key_matches(const char * path, const char * key, int keylen)
+{
+    char key_path[PATH_MAX];
+    char buff[CACHE_KEY_MAX + 1];
+    int fd, len;
+
+    if (snprintf(key_path, PATH_MAX, "%s.key", path) >= PATH_MAX || (fd = open(key_path, O_RDONLY)) < 0)
+	return 0;
+
+    len = read(fd, buff, sizeof(buff));
+    close(fd);
+
+    errno = 0;
+    return (len == keylen && memcmp(buff, key, keylen) == 0);
+}
+
+static int cache_write_key(const char * path, const char * key, int keylen)
+{
+    char key_path[PATH_MAX];
+    char tmp[PATH_MAX];
+    int fd;
+
+    if (snprintf(key_path, PATH_MAX, "%s.key", path) >= PATH_MAX ||
+	snprintf(tmp, PATH_MAX, "%s.%d.tmp", key_path, (int)getpid()) >= PATH_MAX)
+	return -1;
+
+    if ((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
+	return -1;
+
+    if (write(fd, key, keylen) != keylen || close(fd) < 0 || rename(tmp, key_path) < 0)
+    {
+	unlink(tmp);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Fill in 'path' with the entry for 'key' in the cache 'dir'.  Returns 1
+ * if the entry is present, 0 if not, in which case the slot has been
+ * claimed for 'key' and the caller should create the entry at 'path'.
+ * 'path' leaves room for CACHE_PATH_SPARE more characters.
+ */
+int cache_entry_lookup(const char * dir, const char * key, int keylen, const char * suffix, char * path)
+{
+    /* 64 bit FNV-1a */
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char * p = (const unsigned char *)key;
+    char subdir[PATH_MAX];
+    struct stat sbuf;
+    int i, n;
+
+    if (keylen > CACHE_KEY_MAX)
+    {
+	debug(DEBUG_APPERROR, "cache key too long in %s", dir);
+	exit(1);
+    }
+
+    for (i = 0; i < keylen; i++)
+	hash = (hash ^ p[i]) * 1099511628211ULL;
+
+    if (snprintf(subdir, PATH_MAX, "%s/%02x", dir, (unsigned int)(hash >> 56)) >= PATH_MAX)
+    {
+	debug(DEBUG_APPERROR, "cache path too long in %s", dir);
+	exit(1);
+    }
+
+    for (n = 0; n < CACHE_PROBES; n++)
+    {
+	int len;
+
+	if (n == 0)
+	    len = snprintf(path, PATH_MAX, "%s/%016llx%s", subdir, hash, suffix);
+	else
+	    len = snprintf(path, PATH_MAX, "%s/%016llx-%d%s", subdir, hash, n, suffix);
+
+	if (len >= PATH_MAX - CACHE_PATH_SPARE)
+	{
+	    debug(DEBUG_APPERROR, "cache path too long in %s", dir);
+	    exit(1);
+	}
+
+	if (cache_key_matches(path, key, keylen))
+	{
+	    if (stat(path, &sbuf) == 0)
+		return 1;
+
+	    /* the slot is ours, but the entry is gone */
+	    break;
+	}
+
+	/* a free slot;  entries without a key are from older versions */
+	if (errno == ENOENT)
+	{
+	    unlink(path);
+	    break;
+	}
+
+	debug(DEBUG_STATUS, "cache collision with %s", path);
+    }
+
+    if (mkdir(subdir, 0777) < 0 && errno != EEXIST)
+    {
+	debug(DEBUG_SYSERROR, "can't create cache directory %s", subdir);
+	exit(1);
+    }
+
+    /* with every slot taken, the last one is reused */
+    if (n == CACHE_PROBES)
+	unlink(path);
+
+    if (cache_write_key(path, key, keylen) < 0)
+    {
+	debug(DEBUG_SYSERROR, "can't write cache key for %s", path);
+	exit(1);
+    }
+
+    return 0;
+}
+
+/*
+ * Remove the cache entry at 'path' along with its key
+ */
+int cache_entry_remove(const char * path)
+{
+    char key_path[PATH_MAX];
+
+    if (unlink(path) < 0)
+	return -1;
+
+    if (snprintf(key_path, PATH_MAX, "%s.key", path) < PATH_MAX)
+	unlink(key_path);
+
+    return 0;
+}
@@ -8,20 +8,33 @@
 
 #define CVSPS_PREFIX ".cvsps"
 
+/* longest date convert_date() remembers, and format_date() writes */
+#define DATE_STR_MAX 32
+
 #ifndef PATH_MAX
 #define PATH_MAX 4096
 #endif
 
+/* longest key of a cache entry */
+#define CACHE_KEY_MAX (PATH_MAX * 2)
+
+/* room left in a cache entry path for the ".key", ".tmp" etc. files */
+#define CACHE_PATH_SPARE 32
+
 char *xstrdup(char const *);
 void strzncpy(char * dst, const char * src, int n);
 char *readfile(char const *filename, char *buf, size_t size);
 char *strrep(char *s, char find, char replace);
 char *get_cvsps_dir();
 char *get_string(char const *str);
+void get_string_stats(long *, long *);
 void convert_date(time_t *, const char *);
+void format_date(char *, int, time_t);
 void timing_start();
 void timing_stop(const char *);
 int my_system(const char *);
 int escape_filename(char *, int, const char *);
+int cache_entry_lookup(const char *, const char *, int, const char *, char *);
+int cache_entry_remove(const char *);
 
 #endif /* UTIL_H */
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+/*
+ * A pool of threads running work(item, arg) once for each item from 0 to
+ * num_items - 1.  The items are split into one contiguous range per
+ * thread.  A thread takes items from the front of its own range, and
+ * when that is empty steals the back half of the largest range left, so
+ * that a few expensive items don't leave the other threads idle.  The
+ * items may run in any order and on any thread: the work function must
+ * only write state private to its item.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <cbtcommon/debug.h>
+
+#include "workpool.h"
+
+/* more than this is no use to cvsps */
+#define MAX_THREADS 64
+
+struct range
+{
+    pthread_mutex_t lock;
+    int next;
+    int end;
+};
+
+struct pool
+{
+    int threads;
+    struct range * ranges;
+    void (*work)(int, void *);
+    void * arg;
+};
+
+struct worker
+{
+    struct pool * pool;
+    int id;
+    pthread_t thread;
+};
+
+static int take_item(struct range *);
+static int steal_range(struct pool *, int);
+static void * run_worker(void *);
+
+int workpool_default_threads()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cpus < 1)
+	return 1;
+    if (cpus > MAX_THREADS)
+	return MAX_THREADS;
+    return cpus;
+}
+
+void workpool_run(int threads, int num_items, void (*work)(int, void *), void * arg)
+{
+    struct pool pool;
+    struct worker * workers;
+    int i;
+
+    if (threads > MAX_THREADS)
+	threads = MAX_THREADS;
+    if (threads > num_items)
+	threads = num_items;
+
+    if (threads <= 1)
+    {
+	for (i = 0; i < num_items; i++)
+	    work(i, arg);
+	return;
+    }
+
+    pool.threads = threads;
+    pool.work = work;
+    pool.arg = arg;
+    pool.ranges = (struct range *)calloc(threads, sizeof(*pool.ranges));
+    workers = (struct worker *)calloc(threads, sizeof(*workers));
+
+    if (!pool.ranges || !workers)
+    {
+	debug(DEBUG_SYSERROR, "malloc failed for work pool");
+	exit(1);
+    }
+
+    for (i = 0; i < threads; i++)
+    {
+	pthread_mutex_init(&pool.ranges[i].lock, NULL);
+	pool.ranges[i].next = (long)num_items * i / threads;
+	pool.ranges[i].end = (long)num_items * (i + 1) / threads;
+	workers[i].pool = &pool;
+	workers[i].id = i;
+    }
+
+    /* the calling thread is worker 0 */
+    for (i = 1; i < threads; i++)
+    {
+	if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0)
+	{
+	    debug(DEBUG_SYSERROR, "can't create work pool thread");
+	    exit(1);
+	}
+    }
+
+    run_worker(&workers[0]);
+
+    for (i = 1; i < threads; i++)
+	pthread_join(workers[i].thread, NULL);
+
+    for (i = 0; i < threads; i++)
+	pthread_mutex_destroy(&pool.ranges[i].lock);
+
+    free(workers);
+    free(pool.ranges);
+}
+
+static void * run_worker(void * v)
+{
+    struct worker * worker = (struct worker *)v;
+    struct pool * pool = worker->pool;
+    struct range * own = &pool->ranges[worker->id];
+    int item;
+
+    for (;;)
+    {
+	while ((item = take_item(own)) >= 0)
+	    pool->work(item, pool->arg);
+
+	if (!steal_range(pool, worker->id))
+	    break;
+    }
+
+    return NULL;
+}
+
+/* the next item of 'range', or -1 if it is empty */
+static int take_item(struct range * range)
+{
+    int item = -1;
+
+    pthread_mutex_lock(&range->lock);
+    if (range->next < range->end)
+	item = range->next++;
+    pthread_mutex_unlock(&range->lock);
+
+    return item;
+}
+
+/*
+ * Move the back half of the largest other range to the range of thread
+ * 'id', which is empty.  A range with a single item left is left to its
+ * owner.  Returns 0 if there was nothing left to steal.
+ */
+static int steal_range(struct pool * pool, int id)
+{
+    struct range * own = &pool->ranges[id];
+
+    for (;;)
+    {
+	struct range * victim = NULL;
+	int best = 1;
+	int i, next, end;
+
+	for (i = 0; i < pool->threads; i++)
+	{
+	    struct range * range = &pool->ranges[i];
+	    int left;
+
+	    if (i == id)
+		continue;
+
+	    pthread_mutex_lock(&range->lock);
+	    left = range->end - range->next;
+	    pthread_mutex_unlock(&range->lock);
+
+	    if (left > best)
+	    {
+		best = left;
+		victim = range;
+	    }
+	}
+
+	if (!victim)
+	    return 0;
+
+	pthread_mutex_lock(&victim->lock);
+	end = victim->end;
+	next = victim->next + (end - victim->next + 1) / 2;
+	if (next < end)
+	    victim->end = next;
+	pthread_mutex_unlock(&victim->lock);
+
+	/* the victim used up its range in the meantime, look again */
+	if (next >= end)
+	    continue;
+
+	pthread_mutex_lock(&own->lock);
+	own->next = next;
+	own->end = end;
+	pthread_mutex_unlock(&own->lock);
+
+	return 1;
+    }
+}
@@ -0,0 +1,12 @@
+/*
+ * Copyright 2001, 2002, 2003 David Mansfield and Cobite, Inc.
+ * See COPYING file for license information
+ */
+
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+int workpool_default_threads();
+void workpool_run(int threads, int num_items, void (*work)(int, void *), void * arg);
+
+#endif /* WORKPOOL_H */